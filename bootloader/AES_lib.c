@@ -12,6 +12,8 @@
  * \license GPLv3 or later
  */
 
+#include <avr/pgmspace.h>
+
 #include "AES_lib.h"
 #include "AES_lib/aes.h"
 #include "uart.h"
@@ -87,6 +89,64 @@ void contEncCFB(aes256_ctx_t* ctx, uint8_t* nextBlockPlaintext, uint8_t* prevBlo
 
 
 
+/** 
+ * \brief Begins encryption using AES-256 in CFB Mode on a single block, low RAM
+ * 
+ * Same as \code strtEncCFB(), but with the lean key context of AES_lib.h.
+ * 
+ * \param key Pointer to 32-byte AES-256 key.
+ * \param firstBlockPlaintext Pointer to data holding plaintext block to be encrypted.
+ * \param IV Pointer to 16-byte Initialization Vector
+ * \param ctx Pointer to AES-256 on-the-fly context.
+ * \param firstBlockCiphertext Pointer to memory that will hold block of ciphertext
+ */
+void strtEncCFBLean(uint8_t* key, uint8_t* firstBlockPlaintext, uint8_t* IV, aes256_lean_ctx_t* ctx, uint8_t* firstBlockCiphertext) {
+	// Store AES-256 Key
+	aes256_lean_init(key, ctx);
+	
+	// Copy IV to buffer
+	for(uint8_t i = 0; i < 16; i++) {
+		firstBlockCiphertext[i] = IV[i];
+	}
+	
+	// Encrypt IV in buffer
+	aes256_lean_enc(firstBlockCiphertext, ctx);
+	
+	// XOR plaintext with buffer, return ciphertext
+	for(uint8_t i = 0; i < 16; i++) {
+		firstBlockCiphertext[i] ^= firstBlockPlaintext[i];
+	}
+}
+
+
+
+/** 
+ * \brief Continues encryption using AES-256 in CFB Mode on a single block, low RAM
+ * 
+ * Same as \code contEncCFB(), for a context started with \code strtEncCFBLean().
+ * 
+ * \param ctx Pointer to AES-256 on-the-fly context.
+ * \param nextBlockPlaintext Pointer to data holding plaintext block to be encrypted.
+ * \param prevBlockCiphertext Pointer to data holding previous block of ciphertext
+ * \param nextBlockCiphertext Pointer to memory that will hold next block of ciphertext
+ */
+void contEncCFBLean(aes256_lean_ctx_t* ctx, uint8_t* nextBlockPlaintext, uint8_t* prevBlockCiphertext, uint8_t* nextBlockCiphertext) {
+	// Copy previous ciphertext to buffer
+	for(uint8_t i = 0; i < 16; i++) {
+		nextBlockCiphertext[i] = prevBlockCiphertext[i];
+	}
+	
+	// Encrypt previous ciphertext in buffer
+	aes256_lean_enc(nextBlockCiphertext, ctx);
+	
+	// XOR plaintext with buffer, return ciphertext
+	for(uint8_t i = 0; i < 16; i++) {
+		nextBlockCiphertext[i] ^= nextBlockPlaintext[i];
+	}
+}
+
+
+
 /** 
  * \brief Encrypts data in-place using AES-256 in CFB Mode
  * 
@@ -213,6 +273,64 @@ void contDecCFB(aes256_ctx_t* ctx, uint8_t* nextBlockCiphertext, uint8_t* prevBl
 
 
 
+/** 
+ * \brief Begins decryption using AES-256 in CFB Mode on a single block, low RAM
+ * 
+ * Same as \code strtDecCFB(), but with the lean key context of AES_lib.h.
+ * 
+ * \param key Pointer to 32-byte AES-256 key.
+ * \param firstBlockCiphertext Pointer to data holding ciphertext block to be decrypted.
+ * \param IV Pointer to 16-byte Initialization Vector
+ * \param ctx Pointer to AES-256 on-the-fly context.
+ * \param firstBlockPlaintext Pointer to memory that will hold block of plaintext
+ */
+void strtDecCFBLean(uint8_t* key, uint8_t* firstBlockCiphertext, uint8_t* IV, aes256_lean_ctx_t* ctx, uint8_t* firstBlockPlaintext) {
+	// Store AES-256 Key
+	aes256_lean_init(key, ctx);
+	
+	// Copy IV to buffer
+	for(uint8_t i = 0; i < 16; i++) {
+		firstBlockPlaintext[i] = IV[i];
+	}
+	
+	// Encrypt IV in buffer
+	aes256_lean_enc(firstBlockPlaintext, ctx);
+	
+	// XOR ciphertext with buffer, return plaintext
+	for(uint8_t i = 0; i < 16; i++) {
+		firstBlockPlaintext[i] ^= firstBlockCiphertext[i];
+	}
+}
+
+
+
+/** 
+ * \brief Continues decryption using AES-256 in CFB Mode on a single block, low RAM
+ * 
+ * Same as \code contDecCFB(), for a context started with \code strtDecCFBLean().
+ * 
+ * \param ctx Pointer to AES-256 on-the-fly context.
+ * \param nextBlockCiphertext Pointer to data holding ciphertext block to be decrypted.
+ * \param prevBlockCiphertext Pointer to data holding previous block of ciphertext
+ * \param nextBlockPlaintext Pointer to memory that will hold next block of plaintext
+ */
+void contDecCFBLean(aes256_lean_ctx_t* ctx, uint8_t* nextBlockCiphertext, uint8_t* prevBlockCiphertext, uint8_t* nextBlockPlaintext) {
+	// Copy previous ciphertext to buffer
+	for(uint8_t i = 0; i < 16; i++) {
+		nextBlockPlaintext[i] = prevBlockCiphertext[i];
+	}
+	
+	// Encrypt previous ciphertext in buffer
+	aes256_lean_enc(nextBlockPlaintext, ctx);
+	
+	// XOR plaintext with buffer, return ciphertext
+	for(uint8_t i = 0; i < 16; i++) {
+		nextBlockPlaintext[i] ^= nextBlockCiphertext[i];
+	}
+}
+
+
+
 /** 
  * \brief Decrypts data in-place using AES-256 in CFB Mode
  * 
@@ -272,6 +390,465 @@ void decCFB(uint8_t* key, uint8_t* data, uint8_t* IV, uint16_t size) {
 
 
 
+/* CFB MODE ON FLASH */
+
+/** 
+ * \brief Begins encryption or decryption of flash using AES-256 in CFB Mode
+ * 
+ * This method stores the key and IV in the context. The message is then
+ * processed a page at a time with \code encFlashCFB() or \code decFlashCFB(),
+ * which read their input straight from flash with no RAM copy. The context
+ * carries the previous ciphertext block between calls, so pages must be given
+ * in order. The key context is lean, as in \code strtDecCFBLean().
+ * 
+ * \param key Pointer to 32-byte AES-256 key.
+ * \param IV Pointer to 16-byte Initialization Vector
+ * \param ctx Pointer to flash CFB context to initialize.
+ */
+void strtFlashCFB(uint8_t* key, uint8_t* IV, flashCFB_ctx_t* ctx) {
+	// Store AES-256 Key
+	aes256_lean_init(key, &ctx->ctx);
+	
+	// First block is chained to the IV
+	for(uint8_t i = 0; i < 16; i++) {
+		ctx->chain[i] = IV[i];
+	}
+}
+
+
+
+/** 
+ * \brief Encrypts plaintext stored in flash using AES-256 in CFB Mode
+ * 
+ * This method reads size bytes of plaintext from the far flash address and
+ * writes the ciphertext to RAM. It continues the message started with
+ * \code strtFlashCFB() or the last call. The size MUST be divisible by 16.
+ * 
+ * \param ctx Pointer to flash CFB context.
+ * \param address Far flash address of the plaintext.
+ * \param ciphertext Pointer to memory that will hold size bytes of ciphertext.
+ * \param size Size in bytes to encrypt. Must be divisible by 16.
+ */
+void encFlashCFB(flashCFB_ctx_t* ctx, uint32_t address, uint8_t* ciphertext, uint16_t size) {
+	for(uint16_t _address = 0; _address < size; _address += 16) {
+		// Encrypt previous ciphertext into output
+		for(uint8_t i = 0; i < 16; i++) {
+			ciphertext[_address + i] = ctx->chain[i];
+		}
+		
+		aes256_lean_enc(&ciphertext[_address], &ctx->ctx);
+		
+		// XOR plaintext from flash with output, keep ciphertext for next block
+		for(uint8_t i = 0; i < 16; i++) {
+			ciphertext[_address + i] ^= pgm_read_byte_far(address + _address + i);
+			ctx->chain[i] = ciphertext[_address + i];
+		}
+		
+#if SCP_CLOCK_SWITCH
+		switchClock();
+#endif
+	}
+}
+
+
+
+/** 
+ * \brief Decrypts ciphertext stored in flash using AES-256 in CFB Mode
+ * 
+ * This method reads size bytes of ciphertext from the far flash address and
+ * writes the plaintext to RAM. It continues the message started with
+ * \code strtFlashCFB() or the last call. The size MUST be divisible by 16.
+ * 
+ * \param ctx Pointer to flash CFB context.
+ * \param address Far flash address of the ciphertext.
+ * \param plaintext Pointer to memory that will hold size bytes of plaintext.
+ * \param size Size in bytes to decrypt. Must be divisible by 16.
+ */
+void decFlashCFB(flashCFB_ctx_t* ctx, uint32_t address, uint8_t* plaintext, uint16_t size) {
+	uint8_t c;
+	
+	for(uint16_t _address = 0; _address < size; _address += 16) {
+		// Encrypt previous ciphertext into output
+		for(uint8_t i = 0; i < 16; i++) {
+			plaintext[_address + i] = ctx->chain[i];
+		}
+		
+		aes256_lean_enc(&plaintext[_address], &ctx->ctx);
+		
+		// XOR ciphertext from flash with output, keep it for next block
+		for(uint8_t i = 0; i < 16; i++) {
+			c = pgm_read_byte_far(address + _address + i);
+			plaintext[_address + i] ^= c;
+			ctx->chain[i] = c;
+		}
+		
+#if SCP_CLOCK_SWITCH
+		switchClock();
+#endif
+	}
+}
+
+
+
+/** 
+ * \brief Decrypts ciphertext in RAM using AES-256 in CFB Mode
+ * 
+ * Same as \code decFlashCFB(), for ciphertext that was copied from flash to
+ * RAM first, and is decrypted in place. Calls of both continue the same
+ * message. The size MUST be divisible by 16, so a page can be decrypted a few
+ * blocks at a time.
+ * 
+ * \param ctx Pointer to flash CFB context.
+ * \param data Pointer to the ciphertext, replaced with the plaintext.
+ * \param size Size in bytes to decrypt. Must be divisible by 16.
+ */
+void decPageCFB(flashCFB_ctx_t* ctx, uint8_t* data, uint16_t size) {
+	uint8_t block[16];
+	uint8_t c;
+	
+	for(uint16_t _address = 0; _address < size; _address += 16) {
+		// Encrypt previous ciphertext
+		for(uint8_t i = 0; i < 16; i++) {
+			block[i] = ctx->chain[i];
+		}
+		
+		aes256_lean_enc(block, &ctx->ctx);
+		
+		// XOR ciphertext with it, keep the ciphertext for next block
+		for(uint8_t i = 0; i < 16; i++) {
+			c = data[_address + i];
+			data[_address + i] = c ^ block[i];
+			ctx->chain[i] = c;
+		}
+		
+#if SCP_CLOCK_SWITCH
+		switchClock();
+#endif
+	}
+}
+
+
+
+/* CTR MODE BY PAGE */
+
+/** 
+ * \brief Writes the counter block of one block of a page
+ * 
+ * The counter block is the nonce followed by a 32-bit big endian block
+ * number, page * CTR_PAGE_BLOCKS + block.
+ * 
+ * \param ctx Pointer to CTR context.
+ * \param page Page number of the message page.
+ * \param block Block number within the page.
+ * \param keystream Pointer to memory that will hold the 16-byte counter block.
+ */
+static void counterCTR(pageCTR_ctx_t* ctx, uint16_t page, uint8_t block, uint8_t* keystream) {
+	uint32_t counter = (uint32_t)page * CTR_PAGE_BLOCKS + block;
+	
+	for(uint8_t i = 0; i < CTR_NONCE_SIZE; i++) {
+		keystream[i] = ctx->nonce[i];
+	}
+	
+	for(uint8_t i = 15; i >= CTR_NONCE_SIZE; i--) {
+		keystream[i] = counter & 0xff;
+		counter >>= 8;
+	}
+}
+
+
+
+/** 
+ * \brief Begins encryption or decryption using AES-256 in CTR Mode by page
+ * 
+ * This method stores the key and nonce in the context. The counter of each
+ * block is derived from its page number, so unlike CFB every page can be
+ * processed on its own, in any order, with \code cryptCTR() or
+ * \code cryptFlashCTR(). Encryption and decryption are the same operation.
+ * The key context is lean, as in \code strtDecCFBLean(). A nonce must never
+ * be used twice with the same key.
+ * 
+ * \param key Pointer to 32-byte AES-256 key.
+ * \param nonce Pointer to CTR_NONCE_SIZE-byte nonce.
+ * \param ctx Pointer to CTR context to initialize.
+ */
+void strtCTR(uint8_t* key, uint8_t* nonce, pageCTR_ctx_t* ctx) {
+	// Store AES-256 Key
+	aes256_lean_init(key, &ctx->ctx);
+	
+	for(uint8_t i = 0; i < CTR_NONCE_SIZE; i++) {
+		ctx->nonce[i] = nonce[i];
+	}
+}
+
+
+
+/** 
+ * \brief Encrypts or decrypts one page in place using AES-256 in CTR Mode
+ * 
+ * The data may be part of the page, starting offset bytes into it, so a page
+ * can be processed a few blocks at a time.
+ * 
+ * \param ctx Pointer to CTR context, initialized with \code strtCTR().
+ * \param page Page number of the data within the message.
+ * \param offset Offset in bytes of the data within the page, divisible by 16.
+ * \param data Pointer to the data, replaced with its encryption or decryption.
+ * \param size Size in bytes of the data. At most CTR_PAGE_SIZE - offset, divisible by 16.
+ */
+void cryptCTR(pageCTR_ctx_t* ctx, uint16_t page, uint16_t offset, uint8_t* data, uint16_t size) {
+	uint8_t keystream[16];
+	
+	for(uint16_t _address = 0; _address < size; _address += 16) {
+		counterCTR(ctx, page, (offset + _address) / 16, keystream);
+		aes256_lean_enc(keystream, &ctx->ctx);
+		
+		for(uint8_t i = 0; i < 16; i++) {
+			data[_address + i] ^= keystream[i];
+		}
+		
+#if SCP_CLOCK_SWITCH
+		switchClock();
+#endif
+	}
+}
+
+
+
+/** 
+ * \brief Encrypts or decrypts one page of flash using AES-256 in CTR Mode
+ * 
+ * Same as \code cryptCTR(), but reads its input straight from flash.
+ * 
+ * \param ctx Pointer to CTR context, initialized with \code strtCTR().
+ * \param page Page number of the data within the message.
+ * \param address Far flash address of the input.
+ * \param output Pointer to memory that will hold size bytes of output.
+ * \param size Size in bytes of the data. At most CTR_PAGE_SIZE, divisible by 16.
+ */
+void cryptFlashCTR(pageCTR_ctx_t* ctx, uint16_t page, uint32_t address, uint8_t* output, uint16_t size) {
+	for(uint16_t _address = 0; _address < size; _address += 16) {
+		counterCTR(ctx, page, _address / 16, &output[_address]);
+		aes256_lean_enc(&output[_address], &ctx->ctx);
+		
+		// XOR input from flash with keystream
+		for(uint8_t i = 0; i < 16; i++) {
+			output[_address + i] ^= pgm_read_byte_far(address + _address + i);
+		}
+		
+#if SCP_CLOCK_SWITCH
+		switchClock();
+#endif
+	}
+}
+
+
+
+/* CCM MODE AUTHENTICATED ENCRYPTION */
+
+/** 
+ * \brief Adds one plaintext block to the CCM MAC
+ * 
+ * \param ctx Pointer to CCM context.
+ * \param plaintext Pointer to the 16-byte plaintext block.
+ */
+static void macCCM(aeadCCM_ctx_t* ctx, uint8_t* plaintext) {
+	// CBC-MAC over the plaintext
+	for(uint8_t i = 0; i < 16; i++) {
+		ctx->mac[i] ^= plaintext[i];
+	}
+	
+	aes256_enc(ctx->mac, &ctx->ctx);
+}
+
+
+
+/** 
+ * \brief Encrypts the current counter block and moves to the next one
+ * 
+ * \param ctx Pointer to CCM context.
+ * \param keystream Pointer to memory that will hold the 16-byte keystream block.
+ */
+static void nextCounterCCM(aeadCCM_ctx_t* ctx, uint8_t* keystream) {
+	for(uint8_t i = 0; i < 16; i++) {
+		keystream[i] = ctx->counter[i];
+	}
+	
+	aes256_enc(keystream, &ctx->ctx);
+	
+	// Counter is the last 3 bytes, big endian
+	for(uint8_t i = 15; i > CCM_NONCE_SIZE; i--) {
+		if(++ctx->counter[i] != 0) {
+			break;
+		}
+	}
+}
+
+
+
+/** 
+ * \brief Begins encryption or decryption using AES-256 in CCM Mode
+ * 
+ * CCM (NIST SP 800-38C) encrypts with AES-256 in counter mode and authenticates
+ * the plaintext with a CBC-MAC, both under the same key. The Keyschedule is
+ * therefore computed once for both, and each block is encrypted and added to
+ * the MAC in the same pass. This uses a 16-byte tag and a 12-byte nonce.
+ * Associated data, authenticated but not encrypted, must then be added with
+ * \code aadCCM() before any message data. A nonce must never be used twice
+ * with the same key.
+ * 
+ * \param key Pointer to 32-byte AES-256 key.
+ * \param nonce Pointer to CCM_NONCE_SIZE-byte nonce.
+ * \param aadSize Size in bytes of the associated data, 0 for none.
+ * \param size Size in bytes of the whole message. Must be divisible by 16.
+ * \param ctx Pointer to CCM context to initialize.
+ */
+void strtCCM(uint8_t* key, uint8_t* nonce, uint8_t aadSize, uint32_t size, aeadCCM_ctx_t* ctx) {
+	// Compute AES-256 Keyschedule
+	aes256_init(key, &ctx->ctx);
+	
+	// B0 = flags (associated data, 16-byte tag, 3-byte length) | nonce | message length
+	ctx->mac[0] = aadSize ? 0x7A : 0x3A;
+	
+	for(uint8_t i = 0; i < CCM_NONCE_SIZE; i++) {
+		ctx->mac[1 + i] = nonce[i];
+	}
+	
+	ctx->mac[13] = (uint8_t)(size >> 16);
+	ctx->mac[14] = (uint8_t)(size >> 8);
+	ctx->mac[15] = (uint8_t)size;
+	
+	aes256_enc(ctx->mac, &ctx->ctx);
+	
+	// A1 = flags (3-byte counter) | nonce | 1. A0 is kept for the tag.
+	ctx->counter[0] = 0x02;
+	
+	for(uint8_t i = 0; i < CCM_NONCE_SIZE; i++) {
+		ctx->counter[1 + i] = nonce[i];
+	}
+	
+	ctx->counter[13] = 0x00;
+	ctx->counter[14] = 0x00;
+	ctx->counter[15] = 0x01;
+}
+
+
+
+/** 
+ * \brief Adds associated data to the MAC of a CCM message
+ * 
+ * The associated data is authenticated but neither encrypted nor changed. It
+ * is encoded as its 16-bit big endian size followed by the data, zero padded
+ * to a whole block. Must be called once, right after \code strtCCM() with the
+ * same aadSize.
+ * 
+ * \param ctx Pointer to CCM context.
+ * \param aad Pointer to the associated data.
+ * \param aadSize Size in bytes of the associated data, at least 1.
+ */
+void aadCCM(aeadCCM_ctx_t* ctx, uint8_t* aad, uint8_t aadSize) {
+	uint8_t _buffer[16];
+	uint8_t _position = 2;
+	
+	_buffer[0] = 0x00;
+	_buffer[1] = aadSize;
+	
+	for(uint8_t i = 0; i < aadSize; i++) {
+		_buffer[_position++] = aad[i];
+		
+		if(_position == 16) {
+			macCCM(ctx, _buffer);
+			_position = 0;
+		}
+	}
+	
+	if(_position != 0) {
+		while(_position < 16) {
+			_buffer[_position++] = 0x00;
+		}
+		
+		macCCM(ctx, _buffer);
+	}
+}
+
+
+
+/** 
+ * \brief Encrypts data in-place using AES-256 in CCM Mode
+ * 
+ * This method adds the plaintext to the MAC and encrypts it, continuing the
+ * message started with \code strtCCM(). Buffers are chained in the order they
+ * are given.
+ * 
+ * \param ctx Pointer to CCM context.
+ * \param data Pointer to data array. Begins as plaintext, ends as ciphertext.
+ * \param size Size in bytes of data array. Must be divisible by 16.
+ */
+void encCCM(aeadCCM_ctx_t* ctx, uint8_t* data, uint16_t size) {
+	uint8_t _buffer[16];
+	
+	for(uint16_t _address = 0; _address < size; _address += 16) {
+		macCCM(ctx, &data[_address]);
+		nextCounterCCM(ctx, _buffer);
+		
+		for(uint8_t i = 0; i < 16; i++) {
+			data[_address + i] ^= _buffer[i];
+		}
+	}
+}
+
+
+
+/** 
+ * \brief Decrypts data in-place using AES-256 in CCM Mode
+ * 
+ * This method decrypts the ciphertext and adds the plaintext to the MAC,
+ * continuing the message started with \code strtCCM(). Buffers are chained in
+ * the order they are given. The plaintext must not be trusted until the tag
+ * from \code endCCM() has been checked.
+ * 
+ * \param ctx Pointer to CCM context.
+ * \param data Pointer to data array. Begins as ciphertext, ends as plaintext.
+ * \param size Size in bytes of data array. Must be divisible by 16.
+ */
+void decCCM(aeadCCM_ctx_t* ctx, uint8_t* data, uint16_t size) {
+	uint8_t _buffer[16];
+	
+	for(uint16_t _address = 0; _address < size; _address += 16) {
+		nextCounterCCM(ctx, _buffer);
+		
+		for(uint8_t i = 0; i < 16; i++) {
+			data[_address + i] ^= _buffer[i];
+		}
+		
+		macCCM(ctx, &data[_address]);
+	}
+}
+
+
+
+/** 
+ * \brief Finishes a message using AES-256 in CCM Mode
+ * 
+ * This method encrypts the MAC with counter block A0 to give the tag. For
+ * decryption, the tag must be compared to the one sent with the message.
+ * 
+ * \param ctx Pointer to CCM context.
+ * \param tag Pointer to a 16-byte array that will hold the tag.
+ */
+void endCCM(aeadCCM_ctx_t* ctx, uint8_t* tag) {
+	// Back to counter block A0
+	ctx->counter[13] = 0x00;
+	ctx->counter[14] = 0x00;
+	ctx->counter[15] = 0x00;
+	
+	nextCounterCCM(ctx, tag);
+	
+	for(uint8_t i = 0; i < 16; i++) {
+		tag[i] ^= ctx->mac[i];
+	}
+}
+
+
+
 /* CBC-MAC */
 
 /** 
@@ -313,4 +890,188 @@ void hashCBC(uint8_t *key, uint8_t *data, uint8_t *hash, uint16_t size) {
 
 	}
 	
-}
\ No newline at end of file
+}
+
+
+/** 
+ * \brief Begins a 128-bit hash using AES-256 CBC-MAC
+ * 
+ * This method computes the AES-256 Keyschedule once and stores it in the context,
+ * along with a zeroed running hash. The context can then be fed any number of
+ * buffers with \code contHashCBC() before the result is read out with
+ * \code endHashCBC(). Unlike \code hashCBC(), the Keyschedule is not regenerated
+ * for every buffer, which makes hashing large sections of flash page by page
+ * much cheaper.
+ * 
+ * \param key Pointer to 32-byte array containing the AES-256 key.
+ * \param ctx Pointer to CBC-MAC context to initialize.
+ */
+void strtHashCBC(uint8_t* key, hashCBC_ctx_t* ctx) {
+	// Compute AES-256 Keyschedule
+	aes256_init(key, &ctx->ctx);
+	
+	// CBC-MAC always uses an all-zero IV
+	for(uint8_t i = 0; i < 16; i++) {
+		ctx->hash[i] = 0x00;
+	}
+}
+
+
+
+/** 
+ * \brief Continues a 128-bit hash using AES-256 CBC-MAC
+ * 
+ * This method adds a RAM buffer to a hash started with \code strtHashCBC(). The data
+ * is left untouched. Buffers are chained in the order they are given, so hashing
+ * a message in several pieces gives the same result as hashing it in one.
+ * 
+ * \param ctx Pointer to CBC-MAC context.
+ * \param data Pointer to data array to add to the hash.
+ * \param size Size in bytes of data array. Must be divisible by 16.
+ */
+void contHashCBC(hashCBC_ctx_t* ctx, uint8_t* data, uint16_t size) {
+	uint16_t _address = 0;
+	
+	// Hashing Rounds
+	while(_address < size) {
+		// XOR current hash with plaintext
+		for(uint8_t i = 0; i < 16; i++) {
+			ctx->hash[i] ^= data[_address + i];
+		}
+		
+		// Encrypt current hash in place
+		aes256_enc(ctx->hash, &ctx->ctx);
+		
+		// Increment address
+		_address += 16;
+	}
+}
+
+
+
+/** 
+ * \brief Finishes a 128-bit hash using AES-256 CBC-MAC
+ * 
+ * This method copies the final hash out of the context.
+ * 
+ * \param ctx Pointer to CBC-MAC context.
+ * \param hash Pointer to a 16-byte array that will hold the hash.
+ */
+void endHashCBC(hashCBC_ctx_t* ctx, uint8_t* hash) {
+	for(uint8_t i = 0; i < 16; i++) {
+		hash[i] = ctx->hash[i];
+	}
+}
+
+
+
+/** 
+ * \brief Begins a 128-bit hash using AES-256 CBC-MAC, low RAM
+ * 
+ * Same as \code strtHashCBC(), but with the lean key context of AES_lib.h.
+ * 
+ * \param key Pointer to 32-byte array containing the AES-256 key.
+ * \param ctx Pointer to CBC-MAC context to initialize.
+ */
+void strtHashCBCLean(uint8_t* key, hashCBC_lean_ctx_t* ctx) {
+	// Store AES-256 Key
+	aes256_lean_init(key, &ctx->ctx);
+	
+	// CBC-MAC always uses an all-zero IV
+	for(uint8_t i = 0; i < 16; i++) {
+		ctx->hash[i] = 0x00;
+	}
+}
+
+
+
+/** 
+ * \brief Continues a 128-bit hash using AES-256 CBC-MAC, low RAM
+ * 
+ * Same as \code contHashCBC(), for a context started with \code strtHashCBCLean().
+ * 
+ * \param ctx Pointer to CBC-MAC context.
+ * \param data Pointer to data array to add to the hash.
+ * \param size Size in bytes of data array. Must be divisible by 16.
+ */
+void contHashCBCLean(hashCBC_lean_ctx_t* ctx, uint8_t* data, uint16_t size) {
+	uint16_t _address = 0;
+	
+	// Hashing Rounds
+	while(_address < size) {
+		// XOR current hash with plaintext
+		for(uint8_t i = 0; i < 16; i++) {
+			ctx->hash[i] ^= data[_address + i];
+		}
+		
+		// Encrypt current hash in place
+		aes256_lean_enc(ctx->hash, &ctx->ctx);
+		
+		// Increment address
+		_address += 16;
+	}
+}
+
+
+
+/** 
+ * \brief Finishes a 128-bit hash using AES-256 CBC-MAC, low RAM
+ * 
+ * This method copies the final hash out of the context.
+ * 
+ * \param ctx Pointer to CBC-MAC context.
+ * \param hash Pointer to a 16-byte array that will hold the hash.
+ */
+void endHashCBCLean(hashCBC_lean_ctx_t* ctx, uint8_t* hash) {
+	for(uint8_t i = 0; i < 16; i++) {
+		hash[i] = ctx->hash[i];
+	}
+}
+
+
+
+/* KEY DERIVATION */
+
+/** 
+ * \brief Derives a 256-bit key using AES-256 as the PRF of a counter mode KDF
+ * 
+ * Follows NIST SP 800-108 counter mode with a single-block PRF input, so each
+ * half of the derived key is one AES-256 encryption under the input key of:
+ * 
+ *		[counter (1)][label (1)][0x00][id (KDF_ID_SIZE)][0x0100 (2)][0x00 (3)]
+ * 
+ * with counter 1 and 2 and the output length in bits. Different labels give
+ * independent keys from the same key and identifier. Matches deriveKey() in
+ * host_tools/aesfast.py. The derived key may overwrite the input key.
+ * 
+ * \param key Pointer to 32-byte AES-256 key to derive from.
+ * \param label Purpose of the derived key.
+ * \param id Pointer to KDF_ID_SIZE-byte identifier.
+ * \param derivedKey Pointer to memory that will hold the 32-byte derived key.
+ */
+void deriveKey(uint8_t* key, uint8_t label, uint8_t* id, uint8_t* derivedKey) {
+	aes256_ctx_t ctx;
+	
+	// Compute AES-256 Keyschedule
+	aes256_init(key, &ctx);
+	
+	for(uint8_t i = 0; i < 2; i++) {
+		uint8_t* block = &derivedKey[16 * i];
+		
+		block[0] = i + 1;
+		block[1] = label;
+		block[2] = 0;
+		
+		for(uint8_t j = 0; j < KDF_ID_SIZE; j++) {
+			block[3 + j] = id[j];
+		}
+		
+		block[3 + KDF_ID_SIZE] = 0x01;
+		
+		for(uint8_t j = 4 + KDF_ID_SIZE; j < 16; j++) {
+			block[j] = 0;
+		}
+		
+		aes256_enc(block, &ctx);
+	}
+}
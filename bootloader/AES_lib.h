@@ -20,6 +20,24 @@
 
 
 
+/* LEAN KEY CONTEXT */
+
+// Key context of the Lean, flash and CTR functions below. By default it only keeps the
+// 32-byte key and computes the round keys per block, 208 bytes less RAM than aes256_ctx_t.
+// With AES_FULL_KEYS (make AES_FULL_KEYS=1) it holds the full keyschedule instead, so the
+// AES_ASM and AES_MSBOX kernels also run these paths.
+#ifdef AES_FULL_KEYS
+typedef aes256_ctx_t aes256_lean_ctx_t;
+#define aes256_lean_init aes256_init
+#define aes256_lean_enc  aes256_enc
+#else
+typedef aes256_otf_ctx_t aes256_lean_ctx_t;
+#define aes256_lean_init aes256_otf_init
+#define aes256_lean_enc  aes256_enc_otf
+#endif
+
+
+
 /* CFB MODE ENCRYPTION */
 
 // Encrypts entire message. Only used if entire message is in RAM.
@@ -29,6 +47,10 @@ void encCFB(uint8_t* key, uint8_t* data, uint8_t* IV, uint16_t size);
 void strtEncCFB(uint8_t* key, uint8_t* firstBlockPlaintext, uint8_t* IV, aes256_ctx_t* ctx, uint8_t* firstBlockCiphertext);
 void contEncCFB(aes256_ctx_t* ctx, uint8_t* nextBlockPlaintext, uint8_t* prevBlockCiphertext, uint8_t* nextBlockCiphertext);
 
+// Same as above, with a lean key context.
+void strtEncCFBLean(uint8_t* key, uint8_t* firstBlockPlaintext, uint8_t* IV, aes256_lean_ctx_t* ctx, uint8_t* firstBlockCiphertext);
+void contEncCFBLean(aes256_lean_ctx_t* ctx, uint8_t* nextBlockPlaintext, uint8_t* prevBlockCiphertext, uint8_t* nextBlockCiphertext);
+
 
 
 /* CFB MODE DECRYPTION */
@@ -40,11 +62,108 @@ void decCFB(uint8_t* key, uint8_t* data, uint8_t* IV, uint16_t size);
 void strtDecCFB(uint8_t* key, uint8_t* firstBlockCiphertext, uint8_t* IV, aes256_ctx_t* ctx, uint8_t* firstBlockPlaintext);
 void contDecCFB(aes256_ctx_t* ctx, uint8_t* nextBlockCiphertext, uint8_t* prevBlockCiphertext, uint8_t* nextBlockPlaintext);
 
+// Same as above, with a lean key context.
+void strtDecCFBLean(uint8_t* key, uint8_t* firstBlockCiphertext, uint8_t* IV, aes256_lean_ctx_t* ctx, uint8_t* firstBlockPlaintext);
+void contDecCFBLean(aes256_lean_ctx_t* ctx, uint8_t* nextBlockCiphertext, uint8_t* prevBlockCiphertext, uint8_t* nextBlockPlaintext);
+
+
+
+/* CFB MODE ON FLASH */
+
+// Holds the key and the previous ciphertext block of a message read from flash.
+typedef struct {
+	aes256_lean_ctx_t ctx;
+	uint8_t          chain[16];
+} flashCFB_ctx_t;
+
+// Encrypts or decrypts a message page by page, reading its input straight from flash.
+void strtFlashCFB(uint8_t* key, uint8_t* IV, flashCFB_ctx_t* ctx);
+void encFlashCFB(flashCFB_ctx_t* ctx, uint32_t address, uint8_t* ciphertext, uint16_t size);
+void decFlashCFB(flashCFB_ctx_t* ctx, uint32_t address, uint8_t* plaintext, uint16_t size);
+
+// Continues decrypting the message in place in RAM, from ciphertext copied out of flash.
+void decPageCFB(flashCFB_ctx_t* ctx, uint8_t* data, uint16_t size);
+
+
+
+/* CTR MODE BY PAGE */
+
+// Nonce size of CTR messages. Leaves 4 bytes for the block number.
+#define CTR_NONCE_SIZE 12
+
+// Page size the block number is derived from: page * CTR_PAGE_BLOCKS + block.
+#define CTR_PAGE_SIZE   256
+#define CTR_PAGE_BLOCKS (CTR_PAGE_SIZE / 16)
+
+// Holds the key and nonce of a CTR message.
+typedef struct {
+	aes256_lean_ctx_t ctx;
+	uint8_t          nonce[CTR_NONCE_SIZE];
+} pageCTR_ctx_t;
+
+// Encrypts or decrypts any page of a message on its own, from RAM or straight from flash.
+void strtCTR(uint8_t* key, uint8_t* nonce, pageCTR_ctx_t* ctx);
+void cryptCTR(pageCTR_ctx_t* ctx, uint16_t page, uint16_t offset, uint8_t* data, uint16_t size);
+void cryptFlashCTR(pageCTR_ctx_t* ctx, uint16_t page, uint32_t address, uint8_t* output, uint16_t size);
+
+
+
+/* CCM MODE AUTHENTICATED ENCRYPTION */
+
+// Nonce size of CCM messages. Leaves 3 bytes for the message length.
+#define CCM_NONCE_SIZE 12
+
+// Holds the keyschedule, counter block and running MAC of a CCM message.
+typedef struct {
+	aes256_ctx_t ctx;
+	uint8_t      counter[16];
+	uint8_t      mac[16];
+} aeadCCM_ctx_t;
+
+// Encrypts or decrypts a message buffer by buffer, and computes its 16-byte tag. Associated
+// data of aadSize bytes, if any, is added with aadCCM() right after strtCCM().
+void strtCCM(uint8_t* key, uint8_t* nonce, uint8_t aadSize, uint32_t size, aeadCCM_ctx_t* ctx);
+void aadCCM(aeadCCM_ctx_t* ctx, uint8_t* aad, uint8_t aadSize);
+void encCCM(aeadCCM_ctx_t* ctx, uint8_t* data, uint16_t size);
+void decCCM(aeadCCM_ctx_t* ctx, uint8_t* data, uint16_t size);
+void endCCM(aeadCCM_ctx_t* ctx, uint8_t* tag);
+
 
 
 /* CBC-MAC */
 
+// Holds the keyschedule and running hash of a MAC computed over several calls.
+typedef struct {
+	aes256_ctx_t ctx;
+	uint8_t      hash[16];
+} hashCBC_ctx_t;
+
 // Adds a RAM buffer to a MAC/hash. Hash parameter must be initialized to zero for a new hash.
 void hashCBC(uint8_t* key, uint8_t* data, uint8_t* hash, uint16_t size);
 
+// Hashes message buffer by buffer, computing the keyschedule only once. Far more flexible.
+void strtHashCBC(uint8_t* key, hashCBC_ctx_t* ctx);
+void contHashCBC(hashCBC_ctx_t* ctx, uint8_t* data, uint16_t size);
+void endHashCBC(hashCBC_ctx_t* ctx, uint8_t* hash);
+
+// Same as above, with a lean key context.
+typedef struct {
+	aes256_lean_ctx_t ctx;
+	uint8_t          hash[16];
+} hashCBC_lean_ctx_t;
+
+void strtHashCBCLean(uint8_t* key, hashCBC_lean_ctx_t* ctx);
+void contHashCBCLean(hashCBC_lean_ctx_t* ctx, uint8_t* data, uint16_t size);
+void endHashCBCLean(hashCBC_lean_ctx_t* ctx, uint8_t* hash);
+
+
+
+/* KEY DERIVATION */
+
+// Size of the identifier a key is derived for (e.g. a device ID).
+#define KDF_ID_SIZE 8
+
+// Derives a 32-byte key from a key, a one-byte label and an identifier (SP 800-108 counter mode, AES-256 PRF).
+void deriveKey(uint8_t* key, uint8_t label, uint8_t* id, uint8_t* derivedKey);
+
 #endif /* AES_LIB_H_ */
\ No newline at end of file
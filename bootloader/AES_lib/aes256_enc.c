@@ -28,7 +28,22 @@
 #include "aes.h"
 #include "aes_enc.h"
 
+#ifdef BENCHMARK
+/* Blocks encrypted so far, read and cleared by the benchmark */
+uint32_t aesBlockCount = 0;
+#endif
+
 void aes256_enc(void *buffer, aes256_ctx_t *ctx){
+#ifdef BENCHMARK
+	aesBlockCount++;
+#endif
 	aes_encrypt_core(buffer, (aes_genctx_t*)ctx, 14);
 }
 
+void aes256_enc_otf(void *buffer, aes256_otf_ctx_t *ctx){
+#ifdef BENCHMARK
+	aesBlockCount++;
+#endif
+	aes256_encrypt_core_otf(buffer, ctx);
+}
+
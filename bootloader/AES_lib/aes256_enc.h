@@ -41,4 +41,16 @@
  */
 void aes256_enc(void *buffer, aes256_ctx_t *ctx);
 
+/**
+ * \brief encrypt with 256 bit key, computing round keys on the fly.
+ *
+ * This function encrypts one block with the AES algorithm. The round keys are
+ * derived from the key in the context while encrypting, so the context is 32
+ * bytes instead of the 240 byte keyschedule, at the cost of expanding the key
+ * again for every block.
+ * \param buffer pointer to the block to encrypt
+ * \param ctx    pointer to the context set up by aes256_otf_init()
+ */
+void aes256_enc_otf(void *buffer, aes256_otf_ctx_t *ctx);
+
 #endif /* AES256_ENC_H_ */
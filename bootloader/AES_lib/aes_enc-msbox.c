@@ -0,0 +1,211 @@
+/* aes_enc-msbox.c */
+/**
+ * \file    aes_enc-msbox.c
+ * \date    2017-03-27
+ * \license GPLv3 or later
+ *
+ * AES encryption core using a masked S-box table in SRAM, selected with
+ * make AES_MSBOX=1. Replaces aes_encrypt_core() from aes_enc.c.
+ *
+ * Every MSBOX_REMASK_BLOCKS blocks, the core draws an S-box input mask m, an
+ * output mask mo and one MixColumns mask per row, then rebuilds msbox so
+ * that msbox[x ^ m] = S[x] ^ mo. The state stays masked from the first key
+ * addition to the final unmasking:
+ *
+ *   after AddRoundKey   every byte masked with m
+ *   after SubBytes      every byte masked with mo
+ *   before MixColumns   row r masked with col[r]
+ *   after MixColumns    row r masked with MixColumns(col)[r]
+ *
+ * The ShiftRows step keeps each byte in its row, so per-row masks survive it.
+ * S-box lookups are single SRAM loads instead of far flash reads, so there are
+ * no dummy lookups. The SCP profile still controls shuffling (SCP_SHUFFLE),
+ * clock switching (SCP_CLOCK_SWITCH), and whether the masks are random or
+ * zero (SCP_MASKING). The key schedule is unchanged.
+ */
+
+#ifdef AES_ENC_MSBOX
+
+#include <stdint.h>
+#include "aes.h"
+#include "aes_sbox.h"
+#include "aes_enc.h"
+#include "aes_trace.h"
+#include <avr/pgmspace.h>
+
+/* From aes_enc.c */
+void aes_shiftcol(void *data, uint8_t shift);
+uint8_t xtime(uint8_t x);
+
+typedef struct {
+	uint8_t in;       /* S-box input mask m */
+	uint8_t out;      /* S-box output mask mo */
+	uint8_t col[4];   /* mo ^ MixColumns input mask of row r */
+	uint8_t key[4];   /* MixColumns output mask of row r ^ m */
+} msbox_masks_t;
+
+/* Blocks encrypted under the same masks, the blocks of one flash page. Rebuilding
+   msbox takes about as long as encrypting a block, so it is not done for each one. */
+#define MSBOX_REMASK_BLOCKS 16
+
+/* S-box under the current masks: msbox[x ^ m] = S[x] ^ mo */
+static uint8_t msbox[256];
+
+/* Current masks, and the blocks left before they are drawn again */
+static msbox_masks_t msbox_masks;
+static uint8_t       msbox_blocks;
+
+/* Row masks for key additions that do not change the mask */
+static const uint8_t msbox_nomask[4] = {0, 0, 0, 0};
+
+/* Applies MixColumns to one column in place */
+static
+void msbox_mixcol(uint8_t *c)
+{
+    uint8_t t, c0;
+    t  = c[0] ^ c[1] ^ c[2] ^ c[3];
+    c0 = c[0];
+    c[0] ^= xtime(c[0] ^ c[1]) ^ t;
+    c[1] ^= xtime(c[1] ^ c[2]) ^ t;
+    c[2] ^= xtime(c[2] ^ c[3]) ^ t;
+    c[3] ^= xtime(c[3] ^ c0) ^ t;
+}
+
+/* Draws new masks and rebuilds msbox under them */
+static
+void msbox_remask(msbox_masks_t *mk)
+{
+    uint8_t mc[4], mcp[4];
+    uint8_t i;
+#if SCP_MASKING
+    mk->in  = quickRand(&randSeed) & 0xff;
+    mk->out = quickRand(&randSeed) & 0xff;
+    for (i = 0; i < 4; ++i) {
+        mc[i] = quickRand(&randSeed) & 0xff;
+    }
+#else
+    mk->in  = 0;
+    mk->out = 0;
+    for (i = 0; i < 4; ++i) {
+        mc[i] = 0;
+    }
+#endif
+    for (i = 0; i < 4; ++i) {
+        mcp[i] = mc[i];
+    }
+    msbox_mixcol(mcp);
+    for (i = 0; i < 4; ++i) {
+        mk->col[i] = mk->out ^ mc[i];
+        mk->key[i] = mcp[i] ^ mk->in;
+    }
+    i = 0;
+    do {
+        msbox[i ^ mk->in] = pgm_read_byte_far(aes_sbox + i) ^ mk->out;
+    } while (++i);
+}
+
+static
+void msbox_subbytes(uint8_t *dst, const uint8_t *src)
+{
+    uint8_t i, shuffle_index = 0;
+#if SCP_SHUFFLE
+    shuffle_index = quickRand(&randSeed) & 0xf;
+#endif
+    for (i = 0; i < 16; ++i) {
+        shuffle_index = (shuffle_index + 1) & 0xf;
+        dst[shuffle_index] = msbox[src[shuffle_index]];
+        AES_LEAK(dst[shuffle_index]);
+    }
+}
+
+static
+void msbox_addkey(uint8_t *s, const aes_roundkey_t *k, const uint8_t *rowmask)
+{
+    uint8_t i, shuffle_index = 0;
+#if SCP_SHUFFLE
+    shuffle_index = quickRand(&randSeed) & 0xf;
+#endif
+    for (i = 0; i < 16; ++i) {
+        shuffle_index = (shuffle_index + 1) & 0xf;
+        s[shuffle_index] ^= k->ks[shuffle_index];
+        AES_LEAK(s[shuffle_index]);
+        s[shuffle_index] ^= rowmask[shuffle_index & 3];
+        AES_LEAK(s[shuffle_index]);
+    }
+}
+
+static
+void msbox_round(aes_cipher_state_t *state, const aes_roundkey_t *k, const msbox_masks_t *mk)
+{
+    uint8_t tmp[16];
+    uint8_t i;
+    /* subBytes, m -> mo */
+    msbox_subbytes(tmp, state->s);
+    /* mo -> MixColumns input masks */
+    for (i = 0; i < 16; ++i) {
+        tmp[i] ^= mk->col[i & 3];
+    }
+    /* shiftRows */
+    aes_shiftcol(tmp + 1, 1);
+    aes_shiftcol(tmp + 2, 2);
+    aes_shiftcol(tmp + 3, 3);
+    /* mixColums */
+    AES_LEAK_BLOCK(tmp);
+    for (i = 0; i < 16; i += 4) {
+        msbox_mixcol(tmp + i);
+    }
+    for (i = 0; i < 16; ++i) {
+        state->s[i] = tmp[i];
+    }
+    /* addKey, MixColumns output masks -> m */
+    msbox_addkey(state->s, k, mk->key);
+}
+
+static
+void msbox_lastround(aes_cipher_state_t *state, const aes_roundkey_t *k, const msbox_masks_t *mk)
+{
+    uint8_t tmp[16];
+    uint8_t i;
+    /* subBytes, m -> mo */
+    msbox_subbytes(tmp, state->s);
+    /* shiftRows */
+    aes_shiftcol(tmp + 1, 1);
+    aes_shiftcol(tmp + 2, 2);
+    aes_shiftcol(tmp + 3, 3);
+    /* addKey */
+    for (i = 0; i < 16; ++i) {
+        state->s[i] = tmp[i];
+    }
+    msbox_addkey(state->s, k, msbox_nomask);
+    /* unmask */
+    for (i = 0; i < 16; ++i) {
+        state->s[i] ^= mk->out;
+    }
+}
+
+void aes_encrypt_core(aes_cipher_state_t *state, const aes_genctx_t *ks, uint8_t rounds)
+{
+    const msbox_masks_t *mk = &msbox_masks;
+    uint8_t i;
+    if (msbox_blocks == 0) {
+        msbox_remask(&msbox_masks);
+        msbox_blocks = MSBOX_REMASK_BLOCKS;
+    }
+    --msbox_blocks;
+    /* mask the plaintext with m */
+    for (i = 0; i < 16; ++i) {
+        state->s[i] ^= mk->in;
+    }
+    msbox_addkey(state->s, &(ks->key[0]), msbox_nomask);
+    i = 1;
+    for (; rounds > 1; --rounds) {
+        msbox_round(state, &(ks->key[i]), mk);
+#if SCP_CLOCK_SWITCH
+		switchClock();
+#endif
+        ++i;
+    }
+    msbox_lastround(state, &(ks->key[i]), mk);
+}
+
+#endif /* AES_ENC_MSBOX */
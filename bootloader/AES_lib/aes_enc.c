@@ -30,9 +30,13 @@
 #include "aes.h"
 #include "aes_sbox.h"
 #include "aes_enc.h"
+#include "aes_trace.h"
 #include <avr/pgmspace.h>
 #include <stdlib.h>
-#define NUM_DUMMY_OP 5
+
+#if defined(AES_ENC_ASM) && defined(AES_ENC_MSBOX)
+#error "AES_ASM and AES_MSBOX select different kernels, use only one"
+#endif
 
 void aes_shiftcol(void *data, uint8_t shift)
 {
@@ -55,6 +59,131 @@ uint8_t xtime (uint8_t x)
 	return res;
 }
 
+#if SCP_PROFILE == SCP_NONE
+
+/* Plain AES-256, no countermeasures (SCP=none) */
+
+static
+void aes_enc_round(aes_cipher_state_t *state, const aes_roundkey_t *k)
+{
+    uint8_t tmp[16], t;
+    uint8_t i;
+    /* subBytes */
+    for (i = 0; i < 16; ++i) {
+        tmp[i] = pgm_read_byte_far(aes_sbox + state->s[i]);
+        AES_LEAK(tmp[i]);
+    }
+    /* shiftRows */
+    aes_shiftcol(tmp + 1, 1);
+    aes_shiftcol(tmp + 2, 2);
+    aes_shiftcol(tmp + 3, 3);
+    /* mixColums */
+    AES_LEAK_BLOCK(tmp);
+    for (i = 0; i < 4; ++i) {
+        t = tmp[4 * i + 0] ^ tmp[4 * i + 1] ^ tmp[4 * i + 2] ^ tmp[4 * i + 3];
+        state->s[4 * i + 0] = xtime(tmp[4*i+0]^tmp[4*i+1]) ^ tmp[4 * i + 0] ^ t;
+        state->s[4 * i + 1] = xtime(tmp[4*i+1]^tmp[4*i+2]) ^ tmp[4 * i + 1] ^ t;
+        state->s[4 * i + 2] = xtime(tmp[4*i+2]^tmp[4*i+3]) ^ tmp[4 * i + 2] ^ t;
+        state->s[4 * i + 3] = xtime(tmp[4*i+3]^tmp[4*i+0]) ^ tmp[4 * i + 3] ^ t;
+    }
+    /* addKey */
+    for (i = 0; i < 16; ++i) {
+        state->s[i] ^= k->ks[i];
+        AES_LEAK(state->s[i]);
+    }
+}
+
+static
+void aes_enc_lastround(aes_cipher_state_t *state, const aes_roundkey_t *k)
+{
+    uint8_t i;
+    /* subBytes */
+    for (i = 0; i < 16; ++i) {
+        state->s[i] = pgm_read_byte_far(aes_sbox + state->s[i]);
+        AES_LEAK(state->s[i]);
+    }
+    /* shiftRows */
+    aes_shiftcol(state->s + 1, 1);
+    aes_shiftcol(state->s + 2, 2);
+    aes_shiftcol(state->s + 3, 3);
+    /* keyAdd */
+    for (i = 0; i < 16; ++i) {
+        state->s[i] ^= k->ks[i];
+        AES_LEAK(state->s[i]);
+    }
+}
+
+static
+void aes_enc_firstround(aes_cipher_state_t *state, const aes_roundkey_t *k)
+{
+    uint8_t i;
+    for (i = 0; i < 16; ++i) {
+        state->s[i] ^= k->ks[i];
+        AES_LEAK(state->s[i]);
+    }
+}
+
+/* With AES_ENC_ASM or AES_ENC_MSBOX, aes_encrypt_core() comes from aes_enc-asm.S or aes_enc-msbox.c */
+#if !defined(AES_ENC_ASM) && !defined(AES_ENC_MSBOX)
+void aes_encrypt_core(aes_cipher_state_t *state, const aes_genctx_t *ks, uint8_t rounds)
+{
+    uint8_t i;
+    aes_enc_firstround(state, &(ks->key[0]));
+    i = 1;
+    for (; rounds > 1; --rounds) {
+        aes_enc_round(state, &(ks->key[i]));
+        ++i;
+    }
+    aes_enc_lastround(state, &(ks->key[i]));
+}
+#endif /* AES_ENC_ASM, AES_ENC_MSBOX */
+
+#else
+
+/* Masked and shuffled AES-256 (SCP=basic), with dummy operations (SCP=full) */
+
+/*
+ * Random bytes used per block. Rounds draw them from randPool in order
+ * instead of calling quickRand() for each one; aes_encrypt_core() refills
+ * the pool once per block.
+ */
+#if NUM_DUMMY_OP
+#define RAND_ROUND      36
+#define RAND_LASTROUND  37
+#define RAND_CORE       (18 + 2 * NUM_DUMMY_OP)
+#else
+#define RAND_ROUND      34
+#define RAND_LASTROUND  18
+#define RAND_CORE       17
+#endif
+/* Sized for AES-256, 14 rounds */
+#define RAND_POOL_SIZE  (13 * RAND_ROUND + RAND_LASTROUND + RAND_CORE)
+
+static uint8_t randPool[RAND_POOL_SIZE];
+static uint8_t *randNext;
+
+/* Next pool byte; 0..15 for shuffle starts, 0..NUM_DUMMY_OP-1 for dummy splits */
+#define RAND_BYTE()         (*randNext++)
+#define RAND_INDEX()        (RAND_BYTE() & 0xf)
+#define RAND_DUMMY_SPLIT()  ((uint8_t)(((uint16_t)RAND_BYTE() * NUM_DUMMY_OP) >> 8))
+
+/**
+ * Fills the first n bytes of randPool from the quickRand() LFSR and rewinds
+ * randNext. The LFSR step is inlined on a local copy of randSeed, which is
+ * written back at the end.
+ */
+static void fillRandPool(uint16_t n)
+{
+	uint16_t seed = randSeed;
+	uint8_t *p = randPool;
+	while (n--) {
+		seed >>= 1;
+		seed ^= (-(seed & 1)) & 0xB400u;
+		*p++ = (uint8_t)seed;
+	}
+	randSeed = seed;
+	randNext = randPool;
+}
 
 static
 void aes_enc_round(aes_cipher_state_t *state, const aes_roundkey_t *k, uint8_t rounds)
@@ -62,18 +191,21 @@ void aes_enc_round(aes_cipher_state_t *state, const aes_roundkey_t *k, uint8_t r
     uint8_t  tmp[16], t;
     volatile uint8_t i;
 	uint8_t temp;	
+#if NUM_DUMMY_OP
 	uint8_t dummy_before, j;
 	uint8_t dummy_value;
-	dummy_value = quickRand(&randSeed)&0xff;
-	dummy_before = quickRand(&randSeed)%NUM_DUMMY_OP;
+	dummy_value = RAND_BYTE();
+	dummy_before = RAND_DUMMY_SPLIT();
+#endif
 	uint8_t shuffle_index;
-	shuffle_index = quickRand(&randSeed)%16;
+	shuffle_index = RAND_INDEX();
 	//fill tmp with random numbers
 	for (i=0; i <16; i++)
 	{
-		tmp[i] = quickRand(&randSeed)&0xff;
+		tmp[i] = RAND_BYTE();
 	}
     /* subBytes */
+#if NUM_DUMMY_OP
 	//dummy operations for round 1,  2 and 13
 	if (rounds == 1 || rounds == 2 || rounds == 13)
 	{
@@ -82,14 +214,18 @@ void aes_enc_round(aes_cipher_state_t *state, const aes_roundkey_t *k, uint8_t r
 			shuffle_index++;
 			shuffle_index = shuffle_index&0xf;
 			dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
+			AES_LEAK(dummy_value);
 		}
 	}
+#endif
 	//shuffling
 	for (i = 0; i < 16; ++i) {
 		shuffle_index++;
 		shuffle_index = shuffle_index&0xf;
 		tmp[shuffle_index] = pgm_read_byte_far(aes_sbox + state->s[shuffle_index]);
+		AES_LEAK(tmp[shuffle_index]);
 	}
+#if NUM_DUMMY_OP
 	//dummy operations for round 1, 2, and 13
 	if (rounds == 1 || rounds == 2 || rounds ==13)
 	{
@@ -98,13 +234,15 @@ void aes_enc_round(aes_cipher_state_t *state, const aes_roundkey_t *k, uint8_t r
 			shuffle_index++;
 			shuffle_index = shuffle_index&0xf;
 			dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
+			AES_LEAK(dummy_value);
 		}
 	}
+#endif
 	//mask for linear part of AES
 	uint8_t mask[16];
 	for (i = 0; i < 16; i++)
 	{
-		mask[i] = quickRand(&randSeed)%16;
+		mask[i] = RAND_INDEX();
 		tmp[i] = tmp[i] ^ mask[i];
 	}
     /* shiftRows */
@@ -116,6 +254,7 @@ void aes_enc_round(aes_cipher_state_t *state, const aes_roundkey_t *k, uint8_t r
 	aes_shiftcol(mask + 3, 3);
 	
     /* mixColums */
+    AES_LEAK_BLOCK(tmp);
     for ( i = 0; i < 4; ++i) {
         t = tmp[4 * i + 0] ^ tmp[4 * i + 1] ^ tmp[4 * i + 2] ^ tmp[4 * i + 3];
         temp = xtime(tmp[4*i+0]^tmp[4*i+1]);
@@ -152,12 +291,14 @@ void aes_enc_round(aes_cipher_state_t *state, const aes_roundkey_t *k, uint8_t r
 
     /* addKey */
 	//shuffling
-	shuffle_index = quickRand(&randSeed)%16;
+	shuffle_index = RAND_INDEX();
     for (i = 0; i < 16; ++i) {
 		shuffle_index++;
 		shuffle_index = shuffle_index&0xf;
         state->s[shuffle_index] ^= k->ks[shuffle_index];
+		AES_LEAK(state->s[shuffle_index]);
 		state->s[shuffle_index] ^= tmp[shuffle_index];
+		AES_LEAK(state->s[shuffle_index]);
     }
 }
 
@@ -165,38 +306,47 @@ static void aes_enc_lastround(aes_cipher_state_t *state, const aes_roundkey_t *k
 {
     uint8_t i;
 	uint8_t tmp[16];
+#if NUM_DUMMY_OP
 	uint8_t dummy_before, j;
 	uint8_t dummy_value;
-	dummy_value = quickRand(&randSeed)&0xff;
-	dummy_before = quickRand(&randSeed)%NUM_DUMMY_OP;
+	dummy_value = RAND_BYTE();
+	dummy_before = RAND_DUMMY_SPLIT();
+#endif
 	uint8_t shuffle_index;
-	shuffle_index = quickRand(&randSeed)%16;
+	shuffle_index = RAND_INDEX();
 	/* subBytes */
+#if NUM_DUMMY_OP
 	//dummy operations
 	for (j = 0; j < dummy_before; j++)
 	{
 		shuffle_index++;
 		shuffle_index = shuffle_index&0xf;
 		dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
+		AES_LEAK(dummy_value);
 	}
+#endif
 	//shuffling
 	for (i = 0; i < 16; ++i) {
 		shuffle_index++;
 		shuffle_index = shuffle_index&0xf;
 		tmp[shuffle_index] = pgm_read_byte_far(aes_sbox + state->s[shuffle_index]);
+		AES_LEAK(tmp[shuffle_index]);
 	}
+#if NUM_DUMMY_OP
 	//dummy operations
 	for (j = dummy_before; j < NUM_DUMMY_OP; j++)
 	{
 		shuffle_index++;
 		shuffle_index = shuffle_index&0xf;
 		dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
+		AES_LEAK(dummy_value);
 	}
+#endif
 	//mask for linear part of AES
 	uint8_t mask[16];
 	for (i = 0; i < 16; i++)
 	{
-		mask[i] = quickRand(&randSeed)%16;
+		mask[i] = RAND_INDEX();
 		tmp[i] = tmp[i] ^ mask[i];
 	}
 	/* shiftRows */
@@ -208,13 +358,14 @@ static void aes_enc_lastround(aes_cipher_state_t *state, const aes_roundkey_t *k
 	aes_shiftcol(mask + 3, 3);
 
     /* addKey */
+    shuffle_index = RAND_INDEX();
+#if NUM_DUMMY_OP
 	//Dummy operations
 	uint8_t dummy_mask[16];
-    shuffle_index = quickRand(&randSeed)%16;
-	dummy_before = quickRand(&randSeed)%NUM_DUMMY_OP;
+	dummy_before = RAND_DUMMY_SPLIT();
 	for (i = 0; i < 16; i++)
 	{
-		dummy_mask[i] = quickRand(&randSeed)%16;
+		dummy_mask[i] = RAND_INDEX();
 	}
 	for (j = 0; j <dummy_before; j++)
 	{
@@ -223,15 +374,20 @@ static void aes_enc_lastround(aes_cipher_state_t *state, const aes_roundkey_t *k
 		dummy_value = tmp[shuffle_index];
 		dummy_value ^= dummy_mask[shuffle_index];
 		dummy_value ^= mask[shuffle_index];
+		AES_LEAK(dummy_value);
 	}
+#endif
     //shuffling
     for (i = 0; i < 16; ++i) {
 	    shuffle_index++;
 	    shuffle_index = shuffle_index&0xf;
 		state->s[shuffle_index] = tmp[shuffle_index];
 	    state->s[shuffle_index] ^= k->ks[shuffle_index];
+	    AES_LEAK(state->s[shuffle_index]);
 	    state->s[shuffle_index] ^= mask[shuffle_index];
+	    AES_LEAK(state->s[shuffle_index]);
     }
+#if NUM_DUMMY_OP
 	for (j = NUM_DUMMY_OP; j <NUM_DUMMY_OP; j++)
 	{
 		shuffle_index++;
@@ -239,30 +395,36 @@ static void aes_enc_lastround(aes_cipher_state_t *state, const aes_roundkey_t *k
 		dummy_value = tmp[shuffle_index];
 		dummy_value ^= dummy_mask[shuffle_index];
 		dummy_value ^= mask[shuffle_index];
+		AES_LEAK(dummy_value);
 	}
+#endif
 }
 
-void aes_encrypt_core(aes_cipher_state_t *state, const aes_genctx_t *ks, uint8_t rounds)
+/* Round 0 AddRoundKey, masked and shuffled. Draws RAND_CORE pool bytes. */
+static
+void aes_enc_firstround(aes_cipher_state_t *state, const aes_roundkey_t *k)
 {
     uint8_t i;
 	uint8_t mask[16];
 	uint8_t shuffle_index;
-	uint8_t dummy_mask[NUM_DUMMY_OP], dummy_value[NUM_DUMMY_OP];
-	uint8_t dummy_before, j;
-	shuffle_index = quickRand(&randSeed)%16;
 	//mask for round 0
 	for (i = 0; i< 16; i++)
 	{
-		mask[i] = quickRand(&randSeed)&0xff;
+		mask[i] = RAND_BYTE();
 	}
+#if NUM_DUMMY_OP
+	uint8_t dummy_mask[NUM_DUMMY_OP], dummy_value[NUM_DUMMY_OP];
+	uint8_t dummy_before, j;
 	for (i = 0; i <NUM_DUMMY_OP; i++)
 	{
-		dummy_mask[i] = quickRand(&randSeed)&0xff;
-		dummy_value[i] = quickRand(&randSeed)&0xff;		
+		dummy_mask[i] = RAND_BYTE();
+		dummy_value[i] = RAND_BYTE();
 	}
 	//dummy operation
-	dummy_before = quickRand(&randSeed)%NUM_DUMMY_OP;		
-	shuffle_index = quickRand(&randSeed)%16;
+	dummy_before = RAND_DUMMY_SPLIT();
+#endif
+	shuffle_index = RAND_INDEX();
+#if NUM_DUMMY_OP
 	for (j = 0; j <dummy_before; j++)
 	{
 		shuffle_index++;
@@ -270,15 +432,20 @@ void aes_encrypt_core(aes_cipher_state_t *state, const aes_genctx_t *ks, uint8_t
 		dummy_value[j] ^= dummy_mask[j];
 		dummy_value[j] ^= mask[j];
 		dummy_value[j] ^= dummy_mask[j];
+		AES_LEAK(dummy_value[j]);
 	}	
+#endif
 	//shuffle round 0 ARK
 	for (i = 0; i < 16; ++i) {
 		shuffle_index++;
 		shuffle_index &= 0xf;
 		state->s[shuffle_index] ^= mask[i];
-		state->s[shuffle_index] ^= ks->key[0].ks[shuffle_index];
+		state->s[shuffle_index] ^= k->ks[shuffle_index];
+		AES_LEAK(state->s[shuffle_index]);
 		state->s[shuffle_index] ^= mask[i];
+		AES_LEAK(state->s[shuffle_index]);
 	}
+#if NUM_DUMMY_OP
 	//dummy operation
 	for (; j <NUM_DUMMY_OP; j++)
 	{
@@ -287,12 +454,58 @@ void aes_encrypt_core(aes_cipher_state_t *state, const aes_genctx_t *ks, uint8_t
 		dummy_value[j] ^= dummy_mask[j];
 		dummy_value[j] ^= mask[j];
 		dummy_value[j] ^= dummy_mask[j];
+		AES_LEAK(dummy_value[j]);
 	}
+#endif
+}
+
+/* With AES_ENC_ASM or AES_ENC_MSBOX, aes_encrypt_core() comes from aes_enc-asm.S or aes_enc-msbox.c */
+#if !defined(AES_ENC_ASM) && !defined(AES_ENC_MSBOX)
+void aes_encrypt_core(aes_cipher_state_t *state, const aes_genctx_t *ks, uint8_t rounds)
+{
+    uint8_t i;
+	fillRandPool((rounds - 1) * RAND_ROUND + RAND_LASTROUND + RAND_CORE);
+	aes_enc_firstround(state, &(ks->key[0]));
     i = 1;
     for (; rounds > 1; --rounds) {
         aes_enc_round(state, &(ks->key[i]), i);
+#if SCP_CLOCK_SWITCH
 		switchClock();
+#endif
         ++i;
     }
     aes_enc_lastround(state, &(ks->key[i]));
 }
+#endif /* AES_ENC_ASM, AES_ENC_MSBOX */
+
+#endif /* SCP_PROFILE */
+
+/*
+ * AES-256 with the round keys computed from the 32-byte key two at a time as
+ * the rounds need them. Uses the C rounds even with AES_ENC_ASM.
+ */
+void aes256_encrypt_core_otf(aes_cipher_state_t *state, const aes256_otf_ctx_t *ctx)
+{
+    aes_roundkey_t wk[2];
+    uint8_t i;
+    memcpy(wk, ctx->key, sizeof(wk));
+#if SCP_PROFILE != SCP_NONE
+    fillRandPool(RAND_POOL_SIZE);
+#endif
+    aes_enc_firstround(state, &wk[0]);
+    for (i = 1; i < 14; ++i) {
+        if ((i & 1) == 0) {
+            aes256_otf_next(wk, (i >> 1) - 1);
+        }
+#if SCP_PROFILE == SCP_NONE
+        aes_enc_round(state, &wk[i & 1]);
+#else
+        aes_enc_round(state, &wk[i & 1], i);
+#endif
+#if SCP_CLOCK_SWITCH
+		switchClock();
+#endif
+    }
+    aes256_otf_next(wk, 6);
+    aes_enc_lastround(state, &wk[0]);
+}
@@ -27,11 +27,13 @@
 #ifndef AES_ENC_H_
 #define AES_ENC_H_
 #include "aes_types.h"
+#include "aes_scp.h"
 #include <stdint.h>
 
 extern uint16_t randSeed;
 
 void aes_encrypt_core(aes_cipher_state_t *state, const aes_genctx_t *ks, uint8_t rounds);
+void aes256_encrypt_core_otf(aes_cipher_state_t *state, const aes256_otf_ctx_t *ctx);
 extern uint16_t quickRand(uint16_t* seed);
 extern void switchClock(void);
 extern uint8_t fastClock;
@@ -33,8 +33,6 @@
 #include <avr/pgmspace.h>
 #include <stdlib.h>
 
-#define NUM_DUMMY_OP 5
-
 static
 void aes_rotword(void *a)
 {
@@ -53,10 +51,12 @@ const uint8_t rc_tab[] PROGMEM = { 0x01, 0x02, 0x04, 0x08,
 void aes_init(const void *key, uint16_t keysize_b, aes_genctx_t *ctx)
 {
     uint8_t hi, i, nk, next_nk;
+#if NUM_DUMMY_OP
 	uint8_t dummy_value;
 	uint8_t dummy_before = 0;
-	uint8_t shuffle_index = 0;
 	uint8_t j = 0;
+#endif
+	uint8_t shuffle_index = 0;
     uint8_t rc = 0;
     union {
         uint32_t v32;
@@ -64,25 +64,33 @@ void aes_init(const void *key, uint16_t keysize_b, aes_genctx_t *ctx)
     } tmp;
     nk = keysize_b >> 5; /* 4, 6, 8 */
     hi = 4 * (nk + 6 + 1);
+#if SCP_PROFILE != SCP_NONE
 	//First let random number numbers fill the space of round keys
 	for (i = 0; i < keysize_b/8; i++)
 	{
 		ctx->key[1].ks[i] = (uint8_t)(quickRand(&randSeed)&(0xff));
 	}
+#endif
     memcpy(ctx, key, keysize_b / 8);
     next_nk = nk;
+#if NUM_DUMMY_OP
 	dummy_before = (uint8_t)(quickRand(&randSeed)%NUM_DUMMY_OP);
 	dummy_value = quickRand(&randSeed)&0xff;
+#endif
+#if SCP_SHUFFLE
 	shuffle_index = quickRand(&randSeed)&0x3; 		
+#endif
     for (i = nk; i < hi; ++i) {
         tmp.v32 = ((uint32_t*) (ctx->key[0].ks))[i - 1];
         if (i != next_nk) {
             if (nk == 8 && i % 8 == 4) {
+#if NUM_DUMMY_OP
 				//dummy sbox lookup
 				for (j = 0; j <dummy_before; j++)
 				{
 					dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
 				}
+#endif
 				//shuffling
 				for (int k = 0; k < 4; k++)
 				{
@@ -90,22 +98,28 @@ void aes_init(const void *key, uint16_t keysize_b, aes_genctx_t *ctx)
 					shuffle_index = shuffle_index & 0x3; 
 	                tmp.v8[shuffle_index] = pgm_read_byte_far(aes_sbox + tmp.v8[shuffle_index]);
 				}
+#if NUM_DUMMY_OP
 				//dummy sbox lookup
 				for (;j<NUM_DUMMY_OP; j++)
 				{
 					dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
 				}
 				dummy_before = quickRand(&randSeed)%NUM_DUMMY_OP;
+#endif
+#if SCP_SHUFFLE
 				shuffle_index = quickRand(&randSeed)&0x3;
+#endif
             }
         } else {
             next_nk += nk;
             aes_rotword(&(tmp.v32));
+#if NUM_DUMMY_OP
 			//dummy sbox lookup
 			for (j = 0; j <dummy_before; j++)
 			{
 				dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
 			}
+#endif
 			//shuffling
 			for (int k = 0; k < 4; k++)
 			{
@@ -113,13 +127,17 @@ void aes_init(const void *key, uint16_t keysize_b, aes_genctx_t *ctx)
 				shuffle_index = shuffle_index & 0x3;
 				tmp.v8[shuffle_index] = pgm_read_byte_far(aes_sbox + tmp.v8[shuffle_index]);
 			}
+#if NUM_DUMMY_OP
 			//dummy sbox lookup
 			for (;j<NUM_DUMMY_OP; j++)
 			{
 				dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
 			}
 			dummy_before = quickRand(&randSeed)%NUM_DUMMY_OP;
+#endif
+#if SCP_SHUFFLE
 			shuffle_index = quickRand(&randSeed)&0x3;
+#endif
             tmp.v8[0] ^= pgm_read_byte_far(rc_tab + rc);
             rc++;
         }
@@ -131,3 +149,66 @@ void aes256_init(const void *key, aes256_ctx_t *ctx)
 {
     aes_init(key, 256, (aes_genctx_t*) ctx);
 }
+
+void aes256_otf_init(const void *key, aes256_otf_ctx_t *ctx)
+{
+    memcpy(ctx, key, 32);
+}
+
+/* SubWord() with the same countermeasures as aes_init() */
+static
+void aes_subword(void *a)
+{
+#if NUM_DUMMY_OP
+	uint8_t dummy_value, dummy_before, j;
+	dummy_before = (uint8_t)(quickRand(&randSeed)%NUM_DUMMY_OP);
+	dummy_value = quickRand(&randSeed)&0xff;
+	//dummy sbox lookup
+	for (j = 0; j <dummy_before; j++)
+	{
+		dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
+	}
+#endif
+	uint8_t shuffle_index = 0;
+#if SCP_SHUFFLE
+	shuffle_index = quickRand(&randSeed)&0x3;
+#endif
+	//shuffling
+	for (int k = 0; k < 4; k++)
+	{
+		shuffle_index ++;
+		shuffle_index = shuffle_index & 0x3;
+		((uint8_t*) a)[shuffle_index] = pgm_read_byte_far(aes_sbox + ((uint8_t*) a)[shuffle_index]);
+	}
+#if NUM_DUMMY_OP
+	//dummy sbox lookup
+	for (;j<NUM_DUMMY_OP; j++)
+	{
+		dummy_value = pgm_read_byte_far(aes_sbox + dummy_value);
+	}
+#endif
+}
+
+void aes256_otf_next(aes_roundkey_t *wk, uint8_t n)
+{
+    uint32_t *w = (uint32_t*) wk;
+    union {
+        uint32_t v32;
+        uint8_t v8[4];
+    } tmp;
+    uint8_t i;
+    tmp.v32 = w[7];
+    aes_rotword(&(tmp.v32));
+    aes_subword(&(tmp.v32));
+    tmp.v8[0] ^= pgm_read_byte_far(rc_tab + n);
+    w[0] ^= tmp.v32;
+    for (i = 1; i < 4; ++i) {
+        w[i] ^= w[i - 1];
+    }
+    tmp.v32 = w[3];
+    aes_subword(&(tmp.v32));
+    w[4] ^= tmp.v32;
+    for (i = 5; i < 8; ++i) {
+        w[i] ^= w[i - 1];
+    }
+}
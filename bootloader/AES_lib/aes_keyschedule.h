@@ -70,5 +70,24 @@ void aes192_init(const void *key, aes192_ctx_t *ctx);
  */
 void aes256_init(const void *key, aes256_ctx_t *ctx);
 
+/**
+ * \brief initialize an on-the-fly context for 256 bit key
+ *
+ * This function only stores the 256 bit key. Round keys are computed from it
+ * during each encryption, see aes256_enc_otf().
+ * \param key       pointer to the key material
+ * \param ctx       pointer to the context where the key should be stored
+ */
+void aes256_otf_init(const void *key, aes256_otf_ctx_t *ctx);
+
+/**
+ * \brief advance an AES-256 working key by two round keys
+ *
+ * Replaces round keys 2n and 2n+1 in wk with round keys 2n+2 and 2n+3.
+ * \param wk        pointer to the 32 byte working key
+ * \param n         index of the step, 0 for the first call after loading the key
+ */
+void aes256_otf_next(aes_roundkey_t *wk, uint8_t n);
+
 #endif /* AES_KEYSCHEDULE_H_ */
 
@@ -0,0 +1,51 @@
+/* aes_scp.h */
+/**
+ * \file    aes_scp.h
+ * \date    2017-03-20
+ * \license GPLv3 or later
+ *
+ * Side-Channel Protection (SCP) profiles. One profile is picked at build time
+ * with make SCP=none|basic|full, which sets SCP_PROFILE. The default is full.
+ *
+ *  none  - Plain AES-256. No masking, shuffling, dummy operations or clock
+ *          switching.
+ *
+ *  basic - Masked linear layer and shuffled S-box lookups and key additions.
+ *          No dummy operations, and the clock is never switched.
+ *
+ *  full  - Everything in basic, plus NUM_DUMMY_OP dummy operations around
+ *          the first and last rounds and the key schedule S-box lookups,
+ *          and switchClock() between rounds and pages.
+ */
+#ifndef AES_SCP_H_
+#define AES_SCP_H_
+
+#define SCP_NONE  0
+#define SCP_BASIC 1
+#define SCP_FULL  2
+
+#ifndef SCP_PROFILE
+#define SCP_PROFILE SCP_FULL
+#endif
+
+#if (SCP_PROFILE != SCP_NONE) && (SCP_PROFILE != SCP_BASIC) && (SCP_PROFILE != SCP_FULL)
+#error "SCP_PROFILE must be SCP_NONE, SCP_BASIC or SCP_FULL"
+#endif
+
+/* Masking of the linear layer */
+#define SCP_MASKING      (SCP_PROFILE >= SCP_BASIC)
+
+/* Random order of S-box lookups and key additions */
+#define SCP_SHUFFLE      (SCP_PROFILE >= SCP_BASIC)
+
+/* Random switching between the /1 and /8 system clock */
+#define SCP_CLOCK_SWITCH (SCP_PROFILE >= SCP_FULL)
+
+/* Dummy operations padding the protected steps. 0 disables them. */
+#if SCP_PROFILE >= SCP_FULL
+#define NUM_DUMMY_OP 5
+#else
+#define NUM_DUMMY_OP 0
+#endif
+
+#endif /* AES_SCP_H_ */
@@ -0,0 +1,34 @@
+/* aes_trace.h */
+/**
+ * \file    aes_trace.h
+ * \date    2017-03-30
+ * \license GPLv3 or later
+ *
+ * Leakage hooks for the host leakage assessment (host/aes_tvla.c). The C
+ * kernels pass every S-box output, MixColumns input and AddRoundKey result to
+ * AES_LEAK(), including those of dummy operations, in the order they are
+ * computed. Without AES_TRACE the hooks compile to nothing, so device builds
+ * are unchanged.
+ */
+#ifndef AES_TRACE_H_
+#define AES_TRACE_H_
+
+#include <stdint.h>
+
+#ifdef AES_TRACE
+
+/* Defined by the tracing tool */
+void aes_trace(uint8_t value);
+
+#define AES_LEAK(value) aes_trace(value)
+#define AES_LEAK_BLOCK(block) \
+    do { for (uint8_t _l = 0; _l < 16; ++_l) aes_trace((block)[_l]); } while (0)
+
+#else
+
+#define AES_LEAK(value)
+#define AES_LEAK_BLOCK(block)
+
+#endif /* AES_TRACE */
+
+#endif /* AES_TRACE_H_ */
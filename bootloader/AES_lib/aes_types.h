@@ -49,6 +49,11 @@ typedef struct{
 	aes_roundkey_t key[1]; /* just to avoid the warning */
 } aes_genctx_t;
 
+/* AES-256 key only, the round keys are computed on the fly (aes256_enc_otf) */
+typedef struct{
+	aes_roundkey_t key[2];
+} aes256_otf_ctx_t;
+
 typedef struct{
 	uint8_t s[16];
 } aes_cipher_state_t;
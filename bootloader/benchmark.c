@@ -0,0 +1,513 @@
+/*
+ * Benchmark build. Only compiled in when BENCHMARK is defined (make BENCHMARK=1).
+ *
+ * Times the crypto paths used by the bootloader with TIMER1 and prints the
+ * results in CPU cycles on UART0 (DEBUG). TIMER1 runs from the same prescaled
+ * clock as the CPU, so the counts stay in CPU cycles even when switchClock()
+ * drops the core to slow mode. Stack use is measured by painting the free RAM
+ * below the stack and checking how much of the paint got overwritten.
+ */
+
+#ifdef BENCHMARK
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdlib.h>
+
+#include "benchmark.h"
+#include "uart.h"
+
+
+
+/*** VARIABLES ***/
+
+volatile uint16_t timerOverflows = 0;
+
+// End of .data and .bss, set by the linker
+extern uint8_t __heap_start;
+
+
+
+/*** ISRS ***/
+
+ISR(TIMER1_OVF_vect) {
+	timerOverflows++;
+}
+
+
+
+/*** FUNCTION BODIES ***/
+
+/**
+ * \brief Starts counting CPU cycles on TIMER1
+ *
+ * TIMER1 is run with no prescaler. Overflows are counted by the TIMER1_OVF ISR,
+ * so interrupts must be enabled and the vector table placed in the bootloader
+ * section before calling this function.
+ */
+void startCycleCount(void) {
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TCNT1  = 0;
+	TIFR1  = (1<<TOV1);
+	timerOverflows = 0;
+	
+	TIMSK1 = (1<<TOIE1);
+	TCCR1B = (1<<CS10);
+}
+
+
+
+/**
+ * \brief Stops TIMER1 and returns the number of CPU cycles counted
+ *
+ * \return Cycles elapsed since startCycleCount().
+ */
+uint32_t stopCycleCount(void) {
+	uint32_t cycles;
+	
+	cli();
+	TCCR1B = 0;
+	
+	// Catch an overflow that the ISR has not serviced yet
+	if(TIFR1 & (1<<TOV1)) {
+		TIFR1 = (1<<TOV1);
+		timerOverflows++;
+	}
+	
+	cycles = ((uint32_t)timerOverflows << 16) | TCNT1;
+	
+	TIMSK1 = 0;
+	sei();
+	
+	return cycles;
+}
+
+
+
+/**
+ * \brief Prints a benchmark result on UART0 as "name: cycles"
+ *
+ * Also used for other counts, such as AES blocks.
+ *
+ * \param name Null terminated name of the benchmark
+ * \param cycles Number of CPU cycles measured
+ */
+void reportCycles(char* name, uint32_t cycles) {
+	char number[11];
+	
+	ultoa(cycles, number, 10);
+	
+	UART0_putstring(name);
+	UART0_putstring(": ");
+	UART0_putstring(number);
+	UART0_putstring("\n");
+}
+
+
+
+/**
+ * \brief Prints a RAM measurement on UART0 as "name: bytes"
+ *
+ * \param name Null terminated name of the measurement
+ * \param bytes Number of bytes measured
+ */
+void reportBytes(char* name, uint16_t bytes) {
+	char number[6];
+	
+	utoa(bytes, number, 10);
+	
+	UART0_putstring(name);
+	UART0_putstring(": ");
+	UART0_putstring(number);
+	UART0_putstring(" bytes\n");
+}
+
+
+
+/**
+ * \brief Fills the free RAM below the stack with STACK_PAINT
+ *
+ * Everything from the end of .bss up to the stack pointer of this function is
+ * painted. Record SP in the caller before calling this, and pass it to
+ * stackUsed() after the code being measured has run.
+ */
+void paintStack(void) {
+	uint8_t* p = &__heap_start;
+	
+	while(p < (uint8_t*)SP) {
+		*p++ = STACK_PAINT;
+	}
+}
+
+
+
+/**
+ * \brief Returns the stack used since paintStack()
+ *
+ * \param top Stack pointer recorded before paintStack() was called.
+ * \return Number of bytes below top that are no longer STACK_PAINT.
+ */
+uint16_t stackUsed(uint16_t top) {
+	uint8_t* p = &__heap_start;
+	
+	while((p < (uint8_t*)top) && (*p == STACK_PAINT)) {
+		p++;
+	}
+	
+	return top - (uint16_t)p;
+}
+
+
+
+/**
+ * \brief Runs the AES work of one update with full keyschedules
+ *
+ * Hashes BENCH_PAGES pages and decrypts BENCH_PAGES + 1 pages, using a full
+ * keyschedule for each and copying every page to RAM before decrypting it.
+ * The pages are read from the start of flash and are not programmed.
+ *
+ * \return CPU cycles of the MAC and the decryption together.
+ */
+static uint32_t __attribute__((noinline)) benchUpdate(void) {
+	uint8_t       pageBuffer[SPM_PAGESIZE];
+	uint8_t       decryptedBuffer[SPM_PAGESIZE];
+	uint8_t       blockBuffer[16];
+	uint8_t       hash[16];
+	aes256_ctx_t  ctx;
+	hashCBC_ctx_t hashCtx;
+	uint32_t      cycles;
+	uint32_t      updateCycles;
+	
+	/* FIRMWARE MAC, SHARED KEYSCHEDULE */
+	
+	startCycleCount();
+	
+	strtHashCBC(hashKey, &hashCtx);
+	
+	for(int j = 0; j < BENCH_PAGES; j++) {
+		for(int i = 0; i < SPM_PAGESIZE; i++) {
+			pageBuffer[i] = pgm_read_byte_far((uint32_t)j * SPM_PAGESIZE + i);
+		}
+		
+		wdt_reset();
+		
+		contHashCBC(&hashCtx, pageBuffer, SPM_PAGESIZE);
+		
+		switchClock();
+	}
+	
+	endHashCBC(&hashCtx, hash);
+	
+	cycles = stopCycleCount();
+	reportCycles("MAC shared keyschedule", cycles);
+	
+	updateCycles = cycles;
+	
+	
+	
+	/* FIRMWARE DECRYPTION */
+	
+	startCycleCount();
+	
+	for(int j = 0; j < BENCH_PAGES + 1; j++) {
+		for(int i = 0; i < SPM_PAGESIZE; i++) {
+			pageBuffer[i] = pgm_read_byte_far((uint32_t)j * SPM_PAGESIZE + i);
+		}
+		
+		wdt_reset();
+		
+		for(int i = 0; i < SPM_PAGESIZE; i += 16) {
+			if((j == 0) && (i == 0)) {
+				strtDecCFB(firmwareKey, &pageBuffer[0], hash, &ctx, &decryptedBuffer[0]);
+			}
+			else if(i == 0) {
+				contDecCFB(&ctx, &pageBuffer[i], blockBuffer, &decryptedBuffer[0]);
+			}
+			else {
+				contDecCFB(&ctx, &pageBuffer[i], &pageBuffer[i - 16], &decryptedBuffer[i]);
+			}
+			
+			switchClock();
+		}
+		
+		for(int i = 0; i < 16; i++) {
+			blockBuffer[i] = pageBuffer[SPM_PAGESIZE - 16 + i];
+		}
+	}
+	
+	cycles = stopCycleCount();
+	reportCycles("Decrypt", cycles);
+	
+	return updateCycles + cycles;
+}
+
+
+
+/**
+ * \brief Same as benchUpdate(), the way load_firmware() does it
+ *
+ * The contexts are the lean ones of AES_lib.h, and pages are decrypted
+ * straight from flash with decFlashCFB().
+ *
+ * \return CPU cycles of the MAC and the decryption together.
+ */
+static uint32_t __attribute__((noinline)) benchUpdateLean(void) {
+	uint8_t            pageBuffer[SPM_PAGESIZE];
+	uint8_t            decryptedBuffer[SPM_PAGESIZE];
+	uint8_t            hash[16];
+	flashCFB_ctx_t     ctx;
+	hashCBC_lean_ctx_t hashCtx;
+	uint32_t           cycles;
+	uint32_t           updateCycles;
+	
+	/* FIRMWARE MAC, LEAN CONTEXT */
+	
+	startCycleCount();
+	
+	strtHashCBCLean(hashKey, &hashCtx);
+	
+	for(int j = 0; j < BENCH_PAGES; j++) {
+		for(int i = 0; i < SPM_PAGESIZE; i++) {
+			pageBuffer[i] = pgm_read_byte_far((uint32_t)j * SPM_PAGESIZE + i);
+		}
+		
+		wdt_reset();
+		
+		contHashCBCLean(&hashCtx, pageBuffer, SPM_PAGESIZE);
+		
+		switchClock();
+	}
+	
+	endHashCBCLean(&hashCtx, hash);
+	
+	cycles = stopCycleCount();
+	reportCycles("MAC lean", cycles);
+	
+	updateCycles = cycles;
+	
+	
+	
+	/* FIRMWARE DECRYPTION, LEAN CONTEXT, FROM FLASH */
+	
+	startCycleCount();
+	
+	strtFlashCFB(firmwareKey, hash, &ctx);
+	
+	for(int j = 0; j < BENCH_PAGES + 1; j++) {
+		wdt_reset();
+		
+		decFlashCFB(&ctx, (uint32_t)j * SPM_PAGESIZE, decryptedBuffer, SPM_PAGESIZE);
+	}
+	
+	cycles = stopCycleCount();
+	reportCycles("Decrypt lean", cycles);
+	
+	return updateCycles + cycles;
+}
+
+
+
+/**
+ * \brief Same work as benchUpdate() for a CCM image (make IMAGE=ccm)
+ *
+ * Decrypts BENCH_PAGES pages in CCM mode and computes the tag in the same pass,
+ * with one keyschedule. Pages are read from flash into RAM the way
+ * load_firmware() receives them from UART1.
+ *
+ * \return CPU cycles of the decryption and tag together.
+ */
+static uint32_t __attribute__((noinline)) benchUpdateCCM(void) {
+	uint8_t       pageBuffer[SPM_PAGESIZE];
+	uint8_t       hash[16];
+	aeadCCM_ctx_t ctx;
+	uint32_t      cycles;
+	
+	/* FIRMWARE DECRYPTION AND TAG, CCM */
+	
+	startCycleCount();
+	
+	// Any CCM_NONCE_SIZE bytes will do as the nonce
+	strtCCM(firmwareKey, hashKey, 0, BENCH_PAGES * SPM_PAGESIZE, &ctx);
+	
+	for(int j = 0; j < BENCH_PAGES; j++) {
+		for(int i = 0; i < SPM_PAGESIZE; i++) {
+			pageBuffer[i] = pgm_read_byte_far((uint32_t)j * SPM_PAGESIZE + i);
+		}
+		
+		wdt_reset();
+		
+		decCCM(&ctx, pageBuffer, SPM_PAGESIZE);
+		
+		switchClock();
+	}
+	
+	endCCM(&ctx, hash);
+	
+	cycles = stopCycleCount();
+	reportCycles("Decrypt and tag CCM", cycles);
+	
+	return cycles;
+}
+
+
+
+/**
+ * \brief Runs every benchmark once and reports the results on UART0
+ *
+ * Called on the boot path only, so configure, update and readback work as in a
+ * normal build. Returns with interrupts off and the vector table back in the
+ * application section at full clock speed, and main() then boots the firmware.
+ *
+ * The MAC benchmarks hash BENCH_PAGES pages of flash, the size of a firmware
+ * image checked by load_firmware(). The decryption benchmark decrypts
+ * BENCH_PAGES + 1 pages the same way load_firmware() does, without programming
+ * them. The contents of the pages do not matter. "Update crypto" is the AES
+ * work of one firmware update. UART transfer and flash programming come on top
+ * and do not depend on the SCP profile. "Update stack" is the peak stack of
+ * that work, including the page buffers and contexts load_firmware() keeps.
+ * The "lean" results use the lean key contexts (on-the-fly round keys unless
+ * built with AES_FULL_KEYS), and the "CCM" results are for a CCM image.
+ * "AES blocks" counts the block encryptions, keyschedules not included. Flash programming differs between
+ * image formats too, and shows in the update time printed by fw_update.
+ */
+void benchmark(void) {
+	uint8_t          pageBuffer[SPM_PAGESIZE];
+	uint8_t          hash[16];
+	aes256_ctx_t     ctx;
+	aes256_otf_ctx_t otfCtx;
+	uint32_t         cycles;
+	uint16_t         top;
+	
+	// Put Vect Table in Bootloader Section
+	uint8_t temp = MCUCR;
+	
+	MCUCR = temp | (1<<IVCE);
+	MCUCR = temp | (1<<IVSEL);
+	
+	sei();
+	
+#if defined(AES_ENC_ASM)
+	UART0_putstring("Benchmark, assembly AES kernel\n");
+#elif defined(AES_ENC_MSBOX)
+	UART0_putstring("Benchmark, masked S-box AES kernel\n");
+#else
+	UART0_putstring("Benchmark, C AES kernel\n");
+#endif
+
+#if SCP_PROFILE == SCP_NONE
+	UART0_putstring("SCP profile: none\n");
+#elif SCP_PROFILE == SCP_BASIC
+	UART0_putstring("SCP profile: basic\n");
+#else
+	UART0_putstring("SCP profile: full\n");
+#endif
+	
+	
+	
+	/* AES-256 PRIMITIVES */
+	
+	for(uint8_t i = 0; i < 16; i++) {
+		hash[i] = 0x00;
+	}
+	
+	startCycleCount();
+	aes256_init(hashKey, &ctx);
+	reportCycles("aes256_init", stopCycleCount());
+	
+	startCycleCount();
+	aes256_enc(hash, &ctx);
+	reportCycles("aes256_enc", stopCycleCount());
+	
+	aes256_otf_init(hashKey, &otfCtx);
+	
+	startCycleCount();
+	aes256_enc_otf(hash, &otfCtx);
+	reportCycles("aes256_enc_otf", stopCycleCount());
+	
+	
+	
+	/* FIRMWARE MAC, ONE KEYSCHEDULE PER PAGE */
+	
+	for(uint8_t i = 0; i < 16; i++) {
+		hash[i] = 0x00;
+	}
+	
+	startCycleCount();
+	
+	for(int j = 0; j < BENCH_PAGES; j++) {
+		for(int i = 0; i < SPM_PAGESIZE; i++) {
+			pageBuffer[i] = pgm_read_byte_far((uint32_t)j * SPM_PAGESIZE + i);
+		}
+		
+		wdt_reset();
+		
+		hashCBC(hashKey, pageBuffer, hash, SPM_PAGESIZE);
+		
+		switchClock();
+	}
+	
+	cycles = stopCycleCount();
+	reportCycles("MAC per-page keyschedule", cycles);
+	
+	
+	
+	/* ONE UPDATE, FULL KEYSCHEDULE */
+	
+	aesBlockCount = 0;
+	top = SP;
+	paintStack();
+	
+	cycles = benchUpdate();
+	
+	reportCycles("Update crypto", cycles);
+	reportCycles("Update AES blocks", aesBlockCount);
+	reportBytes("Update stack", stackUsed(top));
+	
+	
+	
+	/* ONE UPDATE, LEAN CONTEXTS */
+	
+	aesBlockCount = 0;
+	top = SP;
+	paintStack();
+	
+	cycles = benchUpdateLean();
+	
+	reportCycles("Update crypto lean", cycles);
+	reportCycles("Update AES blocks lean", aesBlockCount);
+	reportBytes("Update stack lean", stackUsed(top));
+	
+	
+	
+	/* ONE UPDATE, CCM IMAGE */
+	
+	aesBlockCount = 0;
+	top = SP;
+	paintStack();
+	
+	cycles = benchUpdateCCM();
+	
+	reportCycles("Update crypto CCM", cycles);
+	reportCycles("Update AES blocks CCM", aesBlockCount);
+	reportBytes("Update stack CCM", stackUsed(top));
+	
+	
+	
+	// switchClock() may have left the clock slow
+	setFastMode();
+	
+	UART0_putstring("Done\n");
+	
+	cli();
+	
+	// Hand Interrupts back to Application Section for boot_firmware()
+	temp = MCUCR;
+	
+	MCUCR = temp | (1<<IVCE);
+	MCUCR = temp & ~(1<<IVSEL);
+}
+
+#endif /* BENCHMARK */
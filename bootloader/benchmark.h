@@ -0,0 +1,50 @@
+/*
+ * Benchmark build headers.
+ */
+
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <stdint.h>
+
+#include "AES_lib.h"
+
+// Pages hashed by the MAC benchmarks (size of a firmware image without its MAC page)
+#define BENCH_PAGES 125
+
+// Fill value for free RAM when measuring stack use
+#define STACK_PAINT 0xC5
+
+// Defined in main.c
+extern uint8_t hashKey[];
+extern uint8_t firmwareKey[];
+extern void switchClock(void);
+extern void setFastMode(void);
+
+// Defined in AES_lib/aes256_enc.c
+extern uint32_t aesBlockCount;
+
+
+
+/* CYCLE COUNTING */
+
+void startCycleCount(void);
+uint32_t stopCycleCount(void);
+void reportCycles(char* name, uint32_t cycles);
+
+
+
+/* STACK MEASUREMENT */
+
+void reportBytes(char* name, uint16_t bytes);
+void paintStack(void);
+uint16_t stackUsed(uint16_t top);
+
+
+
+/* BENCHMARKS */
+
+void benchmark(void);
+
+#endif /* BENCHMARK_H_ */
@@ -0,0 +1,193 @@
+/*
+ * Host benchmark of AES_lib. Built and run with make host-bench.
+ *
+ * Runs each primitive for a fixed number of iterations and prints its wall
+ * clock time per call and throughput, plus the work done per call: AES blocks
+ * (aesBlockCount), quickRand() calls and switchClock() calls. The counts are
+ * the same as on the device for the same build options, so they show what a
+ * kernel change costs even though host timings do not translate to AVR cycles.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "AES_lib.h"
+#include "hal.h"
+
+// Size of the messages given to the modes (a firmware image without its MAC page)
+#define BENCH_SIZE (125UL * 256UL)
+
+// Defined in AES_lib/aes256_enc.c
+extern uint32_t aesBlockCount;
+
+
+
+/*** VARIABLES ***/
+
+static uint8_t key[32];
+static uint8_t IV[16];
+static uint8_t message[BENCH_SIZE];
+
+
+
+/*** FUNCTION BODIES ***/
+
+/**
+ * \brief Returns a monotonic time stamp in nanoseconds
+ */
+static uint64_t now(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+/**
+ * \brief Prints one result line
+ *
+ * \param name Name of the primitive.
+ * \param iterations Number of calls timed.
+ * \param ns Total time of the calls in nanoseconds.
+ * \param bytes Bytes processed per call, 0 if throughput does not apply.
+ */
+static void report(const char* name, uint32_t iterations, uint64_t ns, uint32_t bytes) {
+	double perCall = (double)ns / iterations;
+	
+	printf("%-12s %8u %12.0f", name, iterations, perCall);
+	
+	if(bytes) {
+		printf(" %10.2f", bytes / perCall * 1000.0);
+	}
+	else {
+		printf(" %10s", "-");
+	}
+	
+	printf(" %10.1f %10.1f %10.1f\n",
+		(double)aesBlockCount / iterations,
+		(double)hal_rand_count / iterations,
+		(double)hal_switch_count / iterations);
+}
+
+
+
+/**
+ * \brief Clears the operation counts before a timed run
+ */
+static void clearCounts(void) {
+	aesBlockCount = 0;
+	hal_clear_counts();
+}
+
+
+
+int main(int argc, char** argv) {
+	uint32_t         iterations = 1000;
+	aes256_ctx_t     ctx;
+	uint8_t          block[16] = {0};
+	uint8_t          hash[16]  = {0};
+	uint64_t         start;
+	
+	if(argc > 1) {
+		iterations = strtoul(argv[1], NULL, 0);
+		
+		if(iterations == 0) {
+			fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	for(uint8_t i = 0; i < 32; i++) {
+		key[i] = i;
+	}
+	
+	for(uint8_t i = 0; i < 16; i++) {
+		IV[i] = 0xA0 + i;
+	}
+	
+	for(uint32_t i = 0; i < BENCH_SIZE; i++) {
+		message[i] = i * 13;
+	}
+	
+#if defined(AES_ENC_MSBOX)
+	printf("Host benchmark, masked S-box AES kernel, ");
+#else
+	printf("Host benchmark, C AES kernel, ");
+#endif
+
+#if SCP_PROFILE == SCP_NONE
+	printf("SCP profile: none\n");
+#elif SCP_PROFILE == SCP_BASIC
+	printf("SCP profile: basic\n");
+#else
+	printf("SCP profile: full\n");
+#endif
+
+	printf("Modes process %lu bytes per call\n\n", BENCH_SIZE);
+	printf("%-12s %8s %12s %10s %10s %10s %10s\n",
+		"primitive", "calls", "ns/call", "MB/s", "blocks", "quickRand", "switchClk");
+	
+	
+	
+	/* AES-256 PRIMITIVES */
+	
+	clearCounts();
+	start = now();
+	
+	for(uint32_t i = 0; i < iterations; i++) {
+		aes256_init(key, &ctx);
+	}
+	
+	report("aes256_init", iterations, now() - start, 0);
+	
+	clearCounts();
+	start = now();
+	
+	// Single blocks are short, so they get 100 times as many calls
+	for(uint32_t i = 0; i < iterations * 100; i++) {
+		aes256_enc(block, &ctx);
+	}
+	
+	report("aes256_enc", iterations * 100, now() - start, 16);
+	
+	
+	
+	/* MODES */
+	
+	clearCounts();
+	start = now();
+	
+	for(uint32_t i = 0; i < iterations / 100 + 1; i++) {
+		encCFB(key, message, IV, BENCH_SIZE);
+	}
+	
+	report("encCFB", iterations / 100 + 1, now() - start, BENCH_SIZE);
+	
+	clearCounts();
+	start = now();
+	
+	for(uint32_t i = 0; i < iterations / 100 + 1; i++) {
+		decCFB(key, message, IV, BENCH_SIZE);
+	}
+	
+	report("decCFB", iterations / 100 + 1, now() - start, BENCH_SIZE);
+	
+	clearCounts();
+	start = now();
+	
+	for(uint32_t i = 0; i < iterations / 100 + 1; i++) {
+		hashCBC(key, message, hash, BENCH_SIZE);
+	}
+	
+	report("hashCBC", iterations / 100 + 1, now() - start, BENCH_SIZE);
+	
+	// Keeps the results live
+	printf("\nCheck: %02x%02x%02x%02x %02x%02x%02x%02x\n",
+		block[0], block[1], block[2], block[3], hash[0], hash[1], hash[2], hash[3]);
+	
+	return 0;
+}
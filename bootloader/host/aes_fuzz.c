@@ -0,0 +1,759 @@
+/*
+ * Host differential fuzzer of AES_lib. Built and run with make host-fuzz.
+ *
+ * Compares aes256_enc and aes256_enc_otf against the reference AES-256 in
+ * aes_ref.c for random keys, plaintexts and randSeed values, so that masking,
+ * shuffling and dummy operations are exercised from every starting seed. Every
+ * FUZZ_MODE_EVERY blocks it also checks the modes against the reference: CFB
+ * in RAM and from flash (decPageCFB), CTR by page, CCM with and without
+ * associated data, the CBC-MAC of hashCBC and its contexts, and deriveKey.
+ * The references follow the layouts of fw_protect, and knownAnswers() checks
+ * them against vectors generated with fw_protect first.
+ *
+ * AES_lib keeps its random state in globals, so the work is sharded across
+ * one forked process per core rather than threads. Each process reports back
+ * over a pipe.
+ *
+ * Usage: aes_fuzz [keys] [seed] [processes], default 1000000 keys, a seed from
+ * the clock, and one process per online core.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "AES_lib.h"
+#include "aes_ref.h"
+#include "hal.h"
+
+// A mode check is run every this many single-block checks
+#define FUZZ_MODE_EVERY 64
+
+// Largest message given to the modes, in blocks, one CTR page
+#define FUZZ_MODE_BLOCKS 16
+
+// Emulated flash address the flash functions read their input from
+#define FUZZ_FLASH_ADDRESS 0x1000UL
+
+
+
+/*** TYPES ***/
+
+// Results of one worker, sent to the parent over a pipe
+typedef struct {
+	uint64_t blocks;     // AES_lib blocks compared against the reference
+	uint64_t failures;
+	char     first[192]; // Description of the first failure
+} fuzz_result_t;
+
+
+
+/*** VARIABLES ***/
+
+static uint64_t rngState;
+
+// Known answers generated with host_tools/fw_protect and aesfast.py, for key 00..1f,
+// message 00..3f, nonce a0..ab, associated data c0..d3 and identifier 01..08
+
+// encryptCTRPage(key, nonce, 3, message)
+static const uint8_t katCTR[64] = {
+	0x3d, 0xf2, 0x37, 0x41, 0x34, 0xae, 0xa6, 0x23,
+	0xb0, 0x67, 0xf5, 0x38, 0x85, 0xc5, 0x60, 0x4e,
+	0x2c, 0xa5, 0xe7, 0x28, 0x8f, 0x6d, 0x7f, 0xeb,
+	0xb0, 0x4d, 0xcd, 0xf4, 0xba, 0x56, 0x7b, 0xcd,
+	0xa9, 0xa4, 0xd1, 0x1d, 0xea, 0xa2, 0xcb, 0x11,
+	0xe6, 0xda, 0xd0, 0x0c, 0xee, 0x63, 0x48, 0x14,
+	0x2c, 0x6e, 0x07, 0x7b, 0xf6, 0xf2, 0x19, 0x2a,
+	0xa3, 0x23, 0xb6, 0x6c, 0xb6, 0x38, 0x12, 0xb5
+};
+
+// encryptCCM(key, nonce, message, aad): the ciphertext, the same without aad, and the tags
+static const uint8_t katCCM[64] = {
+	0x6f, 0x95, 0x40, 0x53, 0x94, 0xf9, 0xe0, 0x63,
+	0x42, 0x51, 0x22, 0x29, 0x6b, 0x82, 0xbc, 0xde,
+	0x24, 0xd5, 0xa1, 0x56, 0xaa, 0xab, 0x6e, 0x5f,
+	0xe7, 0xbb, 0xdf, 0x9d, 0xa6, 0xca, 0x84, 0x14,
+	0xce, 0x9f, 0x8b, 0xc3, 0xaa, 0x4a, 0xeb, 0x37,
+	0x62, 0xa5, 0x29, 0x91, 0x5f, 0xc1, 0xf3, 0x78,
+	0xde, 0xb4, 0x7d, 0xac, 0xe2, 0xb2, 0xfc, 0x34,
+	0x24, 0xf5, 0xfb, 0xd7, 0xb5, 0xd6, 0x15, 0xb9
+};
+static const uint8_t katCCMTag[16] = {
+	0x09, 0x0f, 0x98, 0x6d, 0xf4, 0x0e, 0x23, 0x1b,
+	0xe7, 0x0d, 0xf1, 0xc5, 0x62, 0x5e, 0x24, 0x4a
+};
+static const uint8_t katCCMTagNoAAD[16] = {
+	0x89, 0xbb, 0x77, 0xee, 0x5c, 0x58, 0x07, 0xed,
+	0x4f, 0xfc, 0x09, 0xfd, 0x4d, 0xac, 0xbd, 0x1f
+};
+
+// deriveKey(key, 'F', identifier)
+static const uint8_t katKDF[32] = {
+	0xe5, 0x4b, 0xe8, 0x36, 0xef, 0x5d, 0x67, 0x81,
+	0xb9, 0x99, 0x26, 0x06, 0x23, 0x34, 0x62, 0x4d,
+	0x67, 0x13, 0x7f, 0x98, 0x2e, 0xb1, 0x88, 0x75,
+	0x11, 0xf5, 0xf6, 0x59, 0x6b, 0xef, 0x21, 0x20
+};
+
+
+
+/*** FUNCTION BODIES ***/
+
+/**
+ * \brief xorshift64* generator, seeded per worker
+ */
+static uint64_t rng(void) {
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	
+	return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+
+
+static void rngFill(uint8_t* data, uint32_t size) {
+	for(uint32_t i = 0; i < size; i++) {
+		data[i] = rng() >> 56;
+	}
+}
+
+
+
+static uint64_t now(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+/**
+ * \brief Records a failure, keeping the description of the first one
+ */
+static void fail(fuzz_result_t* result, const char* what, const uint8_t* key, uint16_t seed) {
+	if(result->failures++ == 0) {
+		int n = snprintf(result->first, sizeof(result->first), "%s, randSeed %04x, key ", what, seed);
+		
+		for(int i = 0; i < 32 && n < (int)sizeof(result->first) - 3; i++) {
+			n += snprintf(result->first + n, sizeof(result->first) - n, "%02x", key[i]);
+		}
+	}
+}
+
+
+
+/**
+ * \brief Fills the inputs of the known answers
+ */
+static void katInputs(uint8_t* key, uint8_t* message, uint8_t* nonce, uint8_t* aad, uint8_t* id) {
+	for(int i = 0; i < 32; i++) {
+		key[i] = i;
+	}
+	
+	for(int i = 0; i < 64; i++) {
+		message[i] = i;
+	}
+	
+	for(int i = 0; i < 12; i++) {
+		nonce[i] = 0xa0 + i;
+	}
+	
+	for(int i = 0; i < 20; i++) {
+		aad[i] = 0xc0 + i;
+	}
+	
+	for(int i = 0; i < KDF_ID_SIZE; i++) {
+		id[i] = 1 + i;
+	}
+}
+
+
+
+/**
+ * \brief Checks the CTR, CCM and KDF functions against the fw_protect known answers
+ *
+ * \return Description of the first mismatch, or NULL.
+ */
+static const char* katModes(void) {
+	uint8_t       key[32], message[64], data[64], nonce[12], aad[20], id[KDF_ID_SIZE];
+	uint8_t       tag[16], derived[32];
+	pageCTR_ctx_t ctrCtx;
+	aeadCCM_ctx_t ccmCtx;
+	
+	katInputs(key, message, nonce, aad, id);
+	
+	memcpy(data, message, sizeof(data));
+	strtCTR(key, nonce, &ctrCtx);
+	cryptCTR(&ctrCtx, 3, 0, data, sizeof(data));
+	
+	if(memcmp(data, katCTR, sizeof(data))) {
+		return "cryptCTR vs fw_protect";
+	}
+	
+	memcpy(data, message, sizeof(data));
+	strtCCM(key, nonce, sizeof(aad), sizeof(data), &ccmCtx);
+	aadCCM(&ccmCtx, aad, sizeof(aad));
+	encCCM(&ccmCtx, data, sizeof(data));
+	endCCM(&ccmCtx, tag);
+	
+	if(memcmp(data, katCCM, sizeof(data)) || memcmp(tag, katCCMTag, 16)) {
+		return "encCCM vs fw_protect";
+	}
+	
+	strtCCM(key, nonce, 0, sizeof(data), &ccmCtx);
+	decCCM(&ccmCtx, data, sizeof(data));
+	endCCM(&ccmCtx, tag);
+	
+	if(memcmp(data, message, sizeof(data)) || memcmp(tag, katCCMTagNoAAD, 16)) {
+		return "decCCM vs fw_protect";
+	}
+	
+	deriveKey(key, 'F', id, derived);
+	
+	if(memcmp(derived, katKDF, sizeof(derived))) {
+		return "deriveKey vs aesfast";
+	}
+	
+	return NULL;
+}
+
+
+
+/**
+ * \brief Returns a random split point of a message, in whole blocks
+ */
+static uint16_t rngSplit(uint16_t size) {
+	return 16 * (rng() % (size / 16 + 1));
+}
+
+
+
+/**
+ * \brief Checks the flash CFB functions against reference CFB
+ *
+ * The first part of the ciphertext is decrypted from flash with decFlashCFB,
+ * the rest in RAM with decPageCFB, continuing the same message.
+ */
+static void fuzzFlashCFB(fuzz_result_t* result, uint8_t* key, uint8_t* IV, uint8_t* plaintext, uint16_t size, uint16_t seed) {
+	uint8_t        expected[16 * FUZZ_MODE_BLOCKS];
+	uint8_t        data[16 * FUZZ_MODE_BLOCKS];
+	uint16_t       split = rngSplit(size);
+	flashCFB_ctx_t ctx;
+	
+	aes_ref_enc_cfb(key, IV, plaintext, expected, size);
+	
+	memcpy(&hal_flash[FUZZ_FLASH_ADDRESS], plaintext, size);
+	strtFlashCFB(key, IV, &ctx);
+	encFlashCFB(&ctx, FUZZ_FLASH_ADDRESS, data, size);
+	
+	if(memcmp(data, expected, size)) {
+		fail(result, "encFlashCFB", key, seed);
+	}
+	
+	memcpy(&hal_flash[FUZZ_FLASH_ADDRESS], expected, size);
+	memcpy(data, expected, size);
+	strtFlashCFB(key, IV, &ctx);
+	decFlashCFB(&ctx, FUZZ_FLASH_ADDRESS, data, split);
+	decPageCFB(&ctx, data + split, size - split);
+	
+	if(memcmp(data, plaintext, size)) {
+		fail(result, "decFlashCFB/decPageCFB", key, seed);
+	}
+	
+	result->blocks += 2 * (size / 16);
+}
+
+
+
+/**
+ * \brief Checks the CTR functions against reference CTR on a random page
+ *
+ * cryptCTR is given the page in two parts, so the offset is exercised.
+ */
+static void fuzzCTR(fuzz_result_t* result, uint8_t* key, uint8_t* plaintext, uint16_t size, uint16_t seed) {
+	uint8_t       nonce[CTR_NONCE_SIZE];
+	uint8_t       expected[16 * FUZZ_MODE_BLOCKS];
+	uint8_t       data[16 * FUZZ_MODE_BLOCKS];
+	uint16_t      page  = rng();
+	uint16_t      split = rngSplit(size);
+	pageCTR_ctx_t ctx;
+	
+	rngFill(nonce, sizeof(nonce));
+	
+	aes_ref_ctr_page(key, nonce, page, plaintext, expected, size);
+	
+	memcpy(data, plaintext, size);
+	strtCTR(key, nonce, &ctx);
+	cryptCTR(&ctx, page, 0, data, split);
+	cryptCTR(&ctx, page, split, data + split, size - split);
+	
+	if(memcmp(data, expected, size)) {
+		fail(result, "cryptCTR", key, seed);
+	}
+	
+	memcpy(&hal_flash[FUZZ_FLASH_ADDRESS], expected, size);
+	cryptFlashCTR(&ctx, page, FUZZ_FLASH_ADDRESS, data, size);
+	
+	if(memcmp(data, plaintext, size)) {
+		fail(result, "cryptFlashCTR", key, seed);
+	}
+	
+	result->blocks += 2 * (size / 16);
+}
+
+
+
+/**
+ * \brief Checks the CCM functions against reference CCM
+ *
+ * Associated data is added half of the time, up to 255 bytes of it. The message is given to encCCM and decCCM in two parts.
+ */
+static void fuzzCCM(fuzz_result_t* result, uint8_t* key, uint8_t* plaintext, uint16_t size, uint16_t seed) {
+	uint8_t       nonce[CCM_NONCE_SIZE];
+	uint8_t       aad[16 * FUZZ_MODE_BLOCKS];
+	uint8_t       aadSize = (rng() & 1) ? 1 + rng() % (sizeof(aad) - 1) : 0;
+	uint8_t       expected[16 * FUZZ_MODE_BLOCKS];
+	uint8_t       data[16 * FUZZ_MODE_BLOCKS];
+	uint8_t       expectedTag[16], tag[16];
+	uint16_t      split = rngSplit(size);
+	aeadCCM_ctx_t ctx;
+	
+	rngFill(nonce, sizeof(nonce));
+	rngFill(aad, aadSize);
+	
+	aes_ref_enc_ccm(key, nonce, aad, aadSize, plaintext, expected, size, expectedTag);
+	
+	memcpy(data, plaintext, size);
+	strtCCM(key, nonce, aadSize, size, &ctx);
+	
+	if(aadSize) {
+		aadCCM(&ctx, aad, aadSize);
+	}
+	
+	encCCM(&ctx, data, split);
+	encCCM(&ctx, data + split, size - split);
+	endCCM(&ctx, tag);
+	
+	if(memcmp(data, expected, size) || memcmp(tag, expectedTag, 16)) {
+		fail(result, "encCCM", key, seed);
+	}
+	
+	strtCCM(key, nonce, aadSize, size, &ctx);
+	
+	if(aadSize) {
+		aadCCM(&ctx, aad, aadSize);
+	}
+	
+	decCCM(&ctx, data, split);
+	decCCM(&ctx, data + split, size - split);
+	endCCM(&ctx, tag);
+	
+	if(memcmp(data, plaintext, size) || memcmp(tag, expectedTag, 16)) {
+		fail(result, "decCCM", key, seed);
+	}
+	
+	result->blocks += 4 * (size / 16) + 4 + (aadSize ? 2 * ((aadSize + 17) / 16) : 0);
+}
+
+
+
+/**
+ * \brief Checks the CBC-MAC contexts, given the message in two parts, and deriveKey
+ */
+static void fuzzHash(fuzz_result_t* result, uint8_t* key, uint8_t* plaintext, uint16_t size, uint16_t seed) {
+	uint8_t            mac[16], hash[16];
+	uint8_t            id[KDF_ID_SIZE], expected[32], derived[32];
+	uint8_t            label = rng();
+	uint16_t           split = rngSplit(size);
+	hashCBC_ctx_t      ctx;
+	hashCBC_lean_ctx_t leanCtx;
+	
+	aes_ref_cbc_mac(key, plaintext, mac, size);
+	
+	strtHashCBC(key, &ctx);
+	contHashCBC(&ctx, plaintext, split);
+	contHashCBC(&ctx, plaintext + split, size - split);
+	endHashCBC(&ctx, hash);
+	
+	if(memcmp(hash, mac, sizeof(mac))) {
+		fail(result, "contHashCBC", key, seed);
+	}
+	
+	strtHashCBCLean(key, &leanCtx);
+	contHashCBCLean(&leanCtx, plaintext, split);
+	contHashCBCLean(&leanCtx, plaintext + split, size - split);
+	endHashCBCLean(&leanCtx, hash);
+	
+	if(memcmp(hash, mac, sizeof(mac))) {
+		fail(result, "contHashCBCLean", key, seed);
+	}
+	
+	rngFill(id, sizeof(id));
+	aes_ref_derive_key(key, label, id, expected);
+	deriveKey(key, label, id, derived);
+	
+	if(memcmp(derived, expected, sizeof(expected))) {
+		fail(result, "deriveKey", key, seed);
+	}
+	
+	result->blocks += 2 * (size / 16) + 2;
+}
+
+
+
+/**
+ * \brief Checks one random message with every mode
+ */
+static void fuzzModes(fuzz_result_t* result) {
+	uint8_t     key[32], IV[16], hash[16], mac[16];
+	uint8_t     plaintext[16 * FUZZ_MODE_BLOCKS];
+	uint8_t     expected[16 * FUZZ_MODE_BLOCKS];
+	uint8_t     data[16 * FUZZ_MODE_BLOCKS];
+	uint16_t    size = 16 * (1 + rng() % FUZZ_MODE_BLOCKS);
+	uint16_t    seed = rng();
+	const char* what;
+	
+	rngFill(key, sizeof(key));
+	rngFill(IV, sizeof(IV));
+	rngFill(plaintext, size);
+	randSeed = seed;
+	
+	aes_ref_enc_cfb(key, IV, plaintext, expected, size);
+	
+	memcpy(data, plaintext, size);
+	encCFB(key, data, IV, size);
+	
+	if(memcmp(data, expected, size)) {
+		fail(result, "encCFB", key, seed);
+	}
+	
+	decCFB(key, data, IV, size);
+	
+	if(memcmp(data, plaintext, size)) {
+		fail(result, "decCFB", key, seed);
+	}
+	
+	memset(hash, 0, sizeof(hash));
+	hashCBC(key, plaintext, hash, size);
+	aes_ref_cbc_mac(key, plaintext, mac, size);
+	
+	if(memcmp(hash, mac, sizeof(mac))) {
+		fail(result, "hashCBC", key, seed);
+	}
+	
+	result->blocks += 3 * (size / 16);
+	
+	fuzzFlashCFB(result, key, IV, plaintext, size, seed);
+	fuzzCTR(result, key, plaintext, size, seed);
+	fuzzCCM(result, key, plaintext, size, seed);
+	fuzzHash(result, key, plaintext, size, seed);
+	
+	// The known answers again, from this randSeed
+	seed = randSeed = rng();
+	what = katModes();
+	
+	if(what) {
+		// Reported with the key of the known answers
+		for(int i = 0; i < 32; i++) {
+			key[i] = i;
+		}
+		
+		fail(result, what, key, seed);
+	}
+	
+	result->blocks += 20;
+}
+
+
+
+/**
+ * \brief Runs the checks of one worker
+ *
+ * \param result Results, zeroed by the caller.
+ * \param count Number of single-block checks.
+ */
+static void fuzz(fuzz_result_t* result, uint64_t count) {
+	uint8_t          key[32], plaintext[16], expected[16], block[16];
+	uint8_t          roundKeys[AES_REF_ROUNDKEYS_SIZE];
+	uint16_t         seed;
+	aes256_ctx_t     ctx;
+	aes256_otf_ctx_t otfCtx;
+	
+	for(uint64_t i = 0; i < count; i++) {
+		rngFill(key, sizeof(key));
+		rngFill(plaintext, sizeof(plaintext));
+		
+		aes_ref_expand(key, roundKeys);
+		aes_ref_encrypt(roundKeys, plaintext, expected);
+		
+		// Keyschedule and kernel from a random seed
+		seed = randSeed = rng();
+		aes256_init(key, &ctx);
+		memcpy(block, plaintext, 16);
+		aes256_enc(block, &ctx);
+		
+		if(memcmp(block, expected, 16)) {
+			fail(result, "aes256_enc", key, seed);
+		}
+		
+		// On-the-fly keyschedule from another one
+		seed = randSeed = rng();
+		aes256_otf_init(key, &otfCtx);
+		memcpy(block, plaintext, 16);
+		aes256_enc_otf(block, &otfCtx);
+		
+		if(memcmp(block, expected, 16)) {
+			fail(result, "aes256_enc_otf", key, seed);
+		}
+		
+		result->blocks += 2;
+		
+		if(i % FUZZ_MODE_EVERY == 0) {
+			fuzzModes(result);
+		}
+	}
+}
+
+
+
+/**
+ * \brief Checks the reference and AES_lib against fixed vectors before fuzzing
+ *
+ * \return Number of failed vectors.
+ */
+static int knownAnswers(void) {
+	// FIPS-197 Appendix C.3
+	static const uint8_t fipsCiphertext[16] = {
+		0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+		0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89
+	};
+	// CMACHash(key 00..1f, data 00..3f) from host_tools/fw_protect
+	static const uint8_t cmacHash[16] = {
+		0x7c, 0x8a, 0xb8, 0xef, 0x66, 0xc2, 0x93, 0xca,
+		0x63, 0xff, 0x37, 0xa3, 0x5e, 0xc1, 0xc2, 0xba
+	};
+	uint8_t      key[32], data[64], block[16], hash[16];
+	uint8_t      roundKeys[AES_REF_ROUNDKEYS_SIZE];
+	uint8_t      message[64], nonce[12], aad[20], id[KDF_ID_SIZE], derived[32];
+	aes256_ctx_t ctx;
+	const char*  what;
+	int          failures = 0;
+	
+	for(int i = 0; i < 32; i++) {
+		key[i] = i;
+	}
+	
+	for(int i = 0; i < 64; i++) {
+		data[i] = i;
+	}
+	
+	for(int i = 0; i < 16; i++) {
+		block[i] = (i << 4) | i;
+	}
+	
+	aes_ref_expand(key, roundKeys);
+	aes_ref_encrypt(roundKeys, block, hash);
+	
+	if(memcmp(hash, fipsCiphertext, 16)) {
+		printf("FAIL reference AES-256 vs FIPS-197\n");
+		failures++;
+	}
+	
+	aes256_init(key, &ctx);
+	aes256_enc(block, &ctx);
+	
+	if(memcmp(block, fipsCiphertext, 16)) {
+		printf("FAIL aes256_enc vs FIPS-197\n");
+		failures++;
+	}
+	
+	aes_ref_cbc_mac(key, data, hash, sizeof(data));
+	
+	if(memcmp(hash, cmacHash, 16)) {
+		printf("FAIL reference CBC-MAC vs CMACHash\n");
+		failures++;
+	}
+	
+	memset(hash, 0, sizeof(hash));
+	hashCBC(key, data, hash, sizeof(data));
+	
+	if(memcmp(hash, cmacHash, 16)) {
+		printf("FAIL hashCBC vs CMACHash\n");
+		failures++;
+	}
+	
+	katInputs(key, message, nonce, aad, id);
+	
+	aes_ref_ctr_page(key, nonce, 3, message, data, sizeof(data));
+	
+	if(memcmp(data, katCTR, sizeof(data))) {
+		printf("FAIL reference CTR vs fw_protect\n");
+		failures++;
+	}
+	
+	aes_ref_enc_ccm(key, nonce, aad, sizeof(aad), message, data, sizeof(data), hash);
+	
+	if(memcmp(data, katCCM, sizeof(data)) || memcmp(hash, katCCMTag, 16)) {
+		printf("FAIL reference CCM vs fw_protect\n");
+		failures++;
+	}
+	
+	aes_ref_enc_ccm(key, nonce, aad, 0, message, data, sizeof(data), hash);
+	
+	if(memcmp(data, katCCM, sizeof(data)) || memcmp(hash, katCCMTagNoAAD, 16)) {
+		printf("FAIL reference CCM without associated data vs fw_protect\n");
+		failures++;
+	}
+	
+	aes_ref_derive_key(key, 'F', id, derived);
+	
+	if(memcmp(derived, katKDF, sizeof(derived))) {
+		printf("FAIL reference KDF vs aesfast\n");
+		failures++;
+	}
+	
+	what = katModes();
+	
+	if(what) {
+		printf("FAIL %s\n", what);
+		failures++;
+	}
+	
+	return failures;
+}
+
+
+
+int main(int argc, char** argv) {
+	uint64_t      total   = 1000000;
+	uint64_t      seed    = time(NULL);
+	long          workers = sysconf(_SC_NPROCESSORS_ONLN);
+	fuzz_result_t sum, result;
+	uint64_t      start;
+	double        seconds;
+	int           fds[256][2];
+	
+	if(argc > 1) {
+		total = strtoull(argv[1], NULL, 0);
+	}
+	
+	if(argc > 2) {
+		seed = strtoull(argv[2], NULL, 0);
+	}
+	
+	if(argc > 3) {
+		workers = strtol(argv[3], NULL, 0);
+	}
+	
+	if(total == 0 || argc > 4) {
+		fprintf(stderr, "usage: %s [keys] [seed] [processes]\n", argv[0]);
+		return 2;
+	}
+	
+	if(workers < 1) {
+		workers = 1;
+	}
+	
+	if(workers > 256) {
+		workers = 256;
+	}
+	
+#if defined(AES_ENC_MSBOX)
+	printf("Host fuzzer, masked S-box AES kernel, ");
+#else
+	printf("Host fuzzer, C AES kernel, ");
+#endif
+
+#if SCP_PROFILE == SCP_NONE
+	printf("SCP profile: none\n");
+#elif SCP_PROFILE == SCP_BASIC
+	printf("SCP profile: basic\n");
+#else
+	printf("SCP profile: full\n");
+#endif
+	
+	if(knownAnswers()) {
+		return 1;
+	}
+	
+	printf("%llu keys on %ld processes, seed %llu\n",
+		(unsigned long long)total, workers, (unsigned long long)seed);
+	fflush(stdout);
+	
+	start = now();
+	
+	for(long w = 0; w < workers; w++) {
+		if(pipe(fds[w])) {
+			perror("pipe");
+			return 2;
+		}
+		
+		pid_t pid = fork();
+		
+		if(pid < 0) {
+			perror("fork");
+			return 2;
+		}
+		
+		if(pid == 0) {
+			close(fds[w][0]);
+			
+			memset(&result, 0, sizeof(result));
+			rngState = (seed + 1) * 0x9E3779B97F4A7C15ULL + w;
+			rng();
+			
+			fuzz(&result, total / workers + (w < (long)(total % workers)));
+			
+			if(write(fds[w][1], &result, sizeof(result)) != sizeof(result)) {
+				_exit(2);
+			}
+			
+			_exit(0);
+		}
+		
+		close(fds[w][1]);
+	}
+	
+	memset(&sum, 0, sizeof(sum));
+	
+	for(long w = 0; w < workers; w++) {
+		if(read(fds[w][0], &result, sizeof(result)) != sizeof(result)) {
+			printf("FAIL worker %ld did not report\n", w);
+			sum.failures++;
+			continue;
+		}
+		
+		close(fds[w][0]);
+		
+		if(result.failures && !sum.failures) {
+			memcpy(sum.first, result.first, sizeof(sum.first));
+		}
+		
+		sum.blocks   += result.blocks;
+		sum.failures += result.failures;
+	}
+	
+	while(wait(NULL) > 0) {
+	}
+	
+	seconds = (now() - start) / 1e9;
+	
+	printf("%llu blocks in %.2f s, %.0f blocks/s\n",
+		(unsigned long long)sum.blocks, seconds, sum.blocks / seconds);
+	
+	if(sum.failures) {
+		printf("FAIL %llu mismatches, first: %s\n", (unsigned long long)sum.failures, sum.first);
+		return 1;
+	}
+	
+	printf("PASS\n");
+	
+	return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * Reference AES-256 for the host harnesses. Only compiled in by make host.
+ *
+ * The S-box is computed from its definition (inverse in GF(2^8) followed by
+ * the affine map) on first use rather than copied from aes_sbox.c.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "aes_ref.h"
+
+
+
+/*** VARIABLES ***/
+
+static uint8_t sbox[256];
+static uint8_t sboxReady = 0;
+
+
+
+/*** FUNCTION BODIES ***/
+
+static uint8_t gmul(uint8_t a, uint8_t b) {
+	uint8_t p = 0;
+	
+	while(b) {
+		if(b & 1) {
+			p ^= a;
+		}
+		
+		a = (a << 1) ^ ((a & 0x80) ? 0x1B : 0x00);
+		b >>= 1;
+	}
+	
+	return p;
+}
+
+
+
+static uint8_t rotl8(uint8_t x, uint8_t n) {
+	return (x << n) | (x >> (8 - n));
+}
+
+
+
+static void buildSbox(void) {
+	for(int x = 0; x < 256; x++) {
+		uint8_t inv = 0;
+		
+		// 0 has no inverse and maps to 0
+		for(int y = 1; x && y < 256; y++) {
+			if(gmul(x, y) == 1) {
+				inv = y;
+				break;
+			}
+		}
+		
+		sbox[x] = inv ^ rotl8(inv, 1) ^ rotl8(inv, 2) ^ rotl8(inv, 3) ^ rotl8(inv, 4) ^ 0x63;
+	}
+	
+	sboxReady = 1;
+}
+
+
+
+/**
+ * \brief Expands a 32-byte key into the 15 AES-256 round keys
+ */
+void aes_ref_expand(const uint8_t* key, uint8_t* roundKeys) {
+	uint8_t rcon = 0x01;
+	uint8_t t[4];
+	
+	if(!sboxReady) {
+		buildSbox();
+	}
+	
+	memcpy(roundKeys, key, 32);
+	
+	for(int i = 8; i < 60; i++) {
+		memcpy(t, &roundKeys[4 * (i - 1)], 4);
+		
+		if(i % 8 == 0) {
+			uint8_t first = t[0];
+			
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[first];
+			rcon = gmul(rcon, 2);
+		}
+		else if(i % 8 == 4) {
+			for(int j = 0; j < 4; j++) {
+				t[j] = sbox[t[j]];
+			}
+		}
+		
+		for(int j = 0; j < 4; j++) {
+			roundKeys[4 * i + j] = roundKeys[4 * (i - 8) + j] ^ t[j];
+		}
+	}
+}
+
+
+
+/**
+ * \brief Encrypts one block with expanded round keys
+ */
+void aes_ref_encrypt(const uint8_t* roundKeys, const uint8_t* in, uint8_t* out) {
+	uint8_t s[16], t[16];
+	
+	for(int i = 0; i < 16; i++) {
+		s[i] = in[i] ^ roundKeys[i];
+	}
+	
+	for(int round = 1; round <= 14; round++) {
+		// SubBytes and ShiftRows, state is column-major
+		for(int c = 0; c < 4; c++) {
+			for(int r = 0; r < 4; r++) {
+				t[4 * c + r] = sbox[s[4 * ((c + r) % 4) + r]];
+			}
+		}
+		
+		// MixColumns, except in the last round
+		for(int c = 0; c < 4 && round < 14; c++) {
+			uint8_t* col = &t[4 * c];
+			uint8_t  a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+			
+			col[0] = gmul(a0, 2) ^ gmul(a1, 3) ^ a2 ^ a3;
+			col[1] = a0 ^ gmul(a1, 2) ^ gmul(a2, 3) ^ a3;
+			col[2] = a0 ^ a1 ^ gmul(a2, 2) ^ gmul(a3, 3);
+			col[3] = gmul(a0, 3) ^ a1 ^ a2 ^ gmul(a3, 2);
+		}
+		
+		for(int i = 0; i < 16; i++) {
+			s[i] = t[i] ^ roundKeys[16 * round + i];
+		}
+	}
+	
+	memcpy(out, s, 16);
+}
+
+
+
+/**
+ * \brief Encrypts size bytes in CFB mode with a 16-byte segment
+ */
+void aes_ref_enc_cfb(const uint8_t* key, const uint8_t* IV, const uint8_t* in, uint8_t* out, uint32_t size) {
+	uint8_t roundKeys[AES_REF_ROUNDKEYS_SIZE];
+	uint8_t chain[16];
+	
+	aes_ref_expand(key, roundKeys);
+	memcpy(chain, IV, 16);
+	
+	for(uint32_t i = 0; i < size; i += 16) {
+		aes_ref_encrypt(roundKeys, chain, chain);
+		
+		for(int j = 0; j < 16; j++) {
+			out[i + j] = in[i + j] ^ chain[j];
+			chain[j]   = out[i + j];
+		}
+	}
+}
+
+
+
+/**
+ * \brief CBC-MAC of size bytes with a zero IV, the last CBC ciphertext block
+ */
+void aes_ref_cbc_mac(const uint8_t* key, const uint8_t* data, uint8_t* mac, uint32_t size) {
+	uint8_t roundKeys[AES_REF_ROUNDKEYS_SIZE];
+	
+	aes_ref_expand(key, roundKeys);
+	memset(mac, 0, 16);
+	
+	for(uint32_t i = 0; i < size; i += 16) {
+		for(int j = 0; j < 16; j++) {
+			mac[j] ^= data[i + j];
+		}
+		
+		aes_ref_encrypt(roundKeys, mac, mac);
+	}
+}
+
+
+
+/**
+ * \brief Encrypts or decrypts size bytes of one page in CTR mode
+ */
+void aes_ref_ctr_page(const uint8_t* key, const uint8_t* nonce, uint16_t page, const uint8_t* in, uint8_t* out, uint32_t size) {
+	uint8_t  roundKeys[AES_REF_ROUNDKEYS_SIZE];
+	uint8_t  counter[16];
+	uint32_t block;
+	
+	aes_ref_expand(key, roundKeys);
+	
+	for(uint32_t i = 0; i < size; i += 16) {
+		block = (uint32_t)page * 16 + i / 16;
+		
+		memcpy(counter, nonce, 12);
+		counter[12] = block >> 24;
+		counter[13] = block >> 16;
+		counter[14] = block >> 8;
+		counter[15] = block;
+		
+		aes_ref_encrypt(roundKeys, counter, counter);
+		
+		for(int j = 0; j < 16; j++) {
+			out[i + j] = in[i + j] ^ counter[j];
+		}
+	}
+}
+
+
+
+/**
+ * \brief Encrypts size bytes in CCM mode and computes the tag
+ *
+ * Written from SP 800-38C: B0, the associated data encoded with its 2-byte
+ * size, the plaintext, then counter blocks A1, A2, ... for the data and A0
+ * for the tag. size must be divisible by 16.
+ */
+void aes_ref_enc_ccm(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, uint32_t aadSize,
+                     const uint8_t* in, uint8_t* out, uint32_t size, uint8_t* tag) {
+	uint8_t  roundKeys[AES_REF_ROUNDKEYS_SIZE];
+	uint8_t  mac[16], counter[16], block[16];
+	uint8_t  encoded[2 + 256 + 15];
+	uint32_t encodedSize;
+	
+	aes_ref_expand(key, roundKeys);
+	
+	// B0: flags (Adata, t = 16, q = 3), nonce, message length
+	mac[0] = (aadSize ? 0x40 : 0x00) | (((16 - 2) / 2) << 3) | (3 - 1);
+	memcpy(mac + 1, nonce, 12);
+	mac[13] = size >> 16;
+	mac[14] = size >> 8;
+	mac[15] = size;
+	aes_ref_encrypt(roundKeys, mac, mac);
+	
+	if(aadSize) {
+		encoded[0]  = aadSize >> 8;
+		encoded[1]  = aadSize;
+		memcpy(encoded + 2, aad, aadSize);
+		encodedSize = 2 + aadSize;
+		
+		while(encodedSize % 16) {
+			encoded[encodedSize++] = 0;
+		}
+		
+		for(uint32_t i = 0; i < encodedSize; i += 16) {
+			for(int j = 0; j < 16; j++) {
+				mac[j] ^= encoded[i + j];
+			}
+			
+			aes_ref_encrypt(roundKeys, mac, mac);
+		}
+	}
+	
+	// Counter blocks: flags (q = 3), nonce, 3-byte counter
+	counter[0] = 3 - 1;
+	memcpy(counter + 1, nonce, 12);
+	
+	for(uint32_t i = 0; i < size; i += 16) {
+		for(int j = 0; j < 16; j++) {
+			mac[j] ^= in[i + j];
+		}
+		
+		aes_ref_encrypt(roundKeys, mac, mac);
+		
+		counter[13] = (i / 16 + 1) >> 16;
+		counter[14] = (i / 16 + 1) >> 8;
+		counter[15] = (i / 16 + 1);
+		aes_ref_encrypt(roundKeys, counter, block);
+		
+		for(int j = 0; j < 16; j++) {
+			out[i + j] = in[i + j] ^ block[j];
+		}
+	}
+	
+	counter[13] = counter[14] = counter[15] = 0;
+	aes_ref_encrypt(roundKeys, counter, block);
+	
+	for(int j = 0; j < 16; j++) {
+		tag[j] = mac[j] ^ block[j];
+	}
+}
+
+
+
+/**
+ * \brief Derives a 32-byte key, one PRF block per half
+ *
+ * PRF input: counter (1), label (1), 0x00, identifier (8), output length in
+ * bits (0x0100, 2), zero padding (3).
+ */
+void aes_ref_derive_key(const uint8_t* key, uint8_t label, const uint8_t* id, uint8_t* derivedKey) {
+	uint8_t roundKeys[AES_REF_ROUNDKEYS_SIZE];
+	uint8_t block[16];
+	
+	aes_ref_expand(key, roundKeys);
+	
+	for(int i = 0; i < 2; i++) {
+		memset(block, 0, 16);
+		block[0]  = i + 1;
+		block[1]  = label;
+		memcpy(block + 3, id, 8);
+		block[11] = 0x01;
+		block[12] = 0x00;
+		
+		aes_ref_encrypt(roundKeys, block, derivedKey + 16 * i);
+	}
+}
@@ -0,0 +1,36 @@
+/*
+ * Reference AES-256 for the host harnesses. Only compiled in by make host.
+ *
+ * A plain FIPS-197 implementation that shares no code or tables with AES_lib,
+ * so the two can be checked against each other.
+ */
+
+
+#ifndef AES_REF_H_
+#define AES_REF_H_
+
+#include <stdint.h>
+
+// Expanded key of AES-256: 15 round keys
+#define AES_REF_ROUNDKEYS_SIZE 240
+
+void aes_ref_expand(const uint8_t* key, uint8_t* roundKeys);
+void aes_ref_encrypt(const uint8_t* roundKeys, const uint8_t* in, uint8_t* out);
+
+// CFB with a 16-byte segment, and CBC-MAC with a zero IV as CMACHash in the host tools
+void aes_ref_enc_cfb(const uint8_t* key, const uint8_t* IV, const uint8_t* in, uint8_t* out, uint32_t size);
+void aes_ref_cbc_mac(const uint8_t* key, const uint8_t* data, uint8_t* mac, uint32_t size);
+
+// CTR by page as encryptCTRPage in fw_protect: the counter is the 12-byte nonce and a
+// 32-bit big endian block number, page * 16 + block
+void aes_ref_ctr_page(const uint8_t* key, const uint8_t* nonce, uint16_t page, const uint8_t* in, uint8_t* out, uint32_t size);
+
+// CCM as encryptCCM in fw_protect: 12-byte nonce, 16-byte tag, flags 0x3A, or 0x7A with
+// associated data
+void aes_ref_enc_ccm(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, uint32_t aadSize,
+                     const uint8_t* in, uint8_t* out, uint32_t size, uint8_t* tag);
+
+// SP 800-108 counter mode KDF as deriveKey in host_tools/aesfast.py, with an 8-byte identifier
+void aes_ref_derive_key(const uint8_t* key, uint8_t label, const uint8_t* id, uint8_t* derivedKey);
+
+#endif /* AES_REF_H_ */
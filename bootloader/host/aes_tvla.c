@@ -0,0 +1,458 @@
+/*
+ * Host leakage assessment of AES_lib. Built and run with make host-tvla.
+ *
+ * Built with AES_TRACE, so the C kernels report their intermediate values
+ * through aes_trace() (see AES_lib/aes_trace.h). Each call adds one sample,
+ * the Hamming weight of the value plus Gaussian noise, to the trace of the
+ * current block. While switchClock() has the core in slow mode, every sample
+ * is repeated SLOW_CLOCK_FACTOR times, as a fixed-rate scope would see it.
+ *
+ * Traces are split between a fixed plaintext and random plaintexts under a
+ * fixed key, and a Welch t-test is run per sample between the two classes
+ * (fixed-vs-random TVLA). The classes are kept as running means and variances
+ * (Welford), so memory does not grow with the number of traces. Work is
+ * split across forked processes, as in aes_fuzz, and the statistics merged.
+ *
+ * Leakage is the largest |t| and the number of samples above TVLA_THRESHOLD.
+ * Cost is the mean trace length in samples, which counts dummy operations,
+ * masking and slow-clock time. Host time is left to aes_bench, as the
+ * tracing dominates it here.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "AES_lib.h"
+#include "AES_lib/aes_trace.h"
+#include "hal.h"
+
+// |t| above which a sample is reported as leaking
+#define TVLA_THRESHOLD 4.5
+
+// Clock divider of slow mode in switchClock()
+#define SLOW_CLOCK_FACTOR 8
+
+#define MAX_WORKERS 256
+
+
+
+/*** TYPES ***/
+
+// Running statistics of one class, one entry per sample
+typedef struct {
+	uint64_t n;
+	double*  mean;
+	double*  m2;
+} tvla_class_t;
+
+// Totals of one worker, sent to the parent over a pipe before its classes
+typedef struct {
+	uint64_t traces;
+	uint64_t samples;  // Trace length summed over all traces
+} tvla_totals_t;
+
+
+
+/*** VARIABLES ***/
+
+static uint64_t rngState;
+
+static uint32_t window    = 2048;
+static double   noise     = 1.0;
+
+static double*  trace;
+static uint32_t tracePos;
+
+
+
+/*** FUNCTION BODIES ***/
+
+static uint64_t rng(void) {
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+
+	return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+
+
+static void rngFill(uint8_t* data, uint32_t size) {
+	for(uint32_t i = 0; i < size; i++) {
+		data[i] = rng() >> 56;
+	}
+}
+
+
+
+/**
+ * \brief Standard normal sample (Box-Muller)
+ */
+static double gaussian(void) {
+	double u1 = ((rng() >> 11) + 1.0) / 9007199254740993.0;
+	double u2 =  (rng() >> 11)        / 9007199254740992.0;
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+
+static uint64_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+/**
+ * \brief Leakage hook called by the kernels, adds one sample to the trace
+ */
+void aes_trace(uint8_t value) {
+	uint8_t repeat = fastClock ? 1 : SLOW_CLOCK_FACTOR;
+	double  weight = __builtin_popcount(value);
+
+	while(repeat--) {
+		if(tracePos < window) {
+			trace[tracePos] = weight + noise * gaussian();
+		}
+
+		tracePos++;
+	}
+}
+
+
+
+static int classAlloc(tvla_class_t* c) {
+	c->n    = 0;
+	c->mean = calloc(window, sizeof(double));
+	c->m2   = calloc(window, sizeof(double));
+
+	return c->mean && c->m2;
+}
+
+
+
+/**
+ * \brief Adds the current trace to a class (Welford update)
+ */
+static void classAdd(tvla_class_t* c) {
+	c->n++;
+
+	for(uint32_t i = 0; i < window; i++) {
+		double delta = trace[i] - c->mean[i];
+
+		c->mean[i] += delta / c->n;
+		c->m2[i]   += delta * (trace[i] - c->mean[i]);
+	}
+}
+
+
+
+/**
+ * \brief Merges class b into class a (Chan et al.)
+ */
+static void classMerge(tvla_class_t* a, const tvla_class_t* b) {
+	uint64_t n = a->n + b->n;
+
+	if(b->n == 0) {
+		return;
+	}
+
+	for(uint32_t i = 0; i < window; i++) {
+		double delta = b->mean[i] - a->mean[i];
+
+		a->m2[i]   += b->m2[i] + delta * delta * a->n * b->n / n;
+		a->mean[i] += delta * b->n / n;
+	}
+
+	a->n = n;
+}
+
+
+
+static int writeAll(int fd, const void* data, size_t size) {
+	const uint8_t* p = data;
+
+	while(size) {
+		ssize_t n = write(fd, p, size);
+
+		if(n <= 0) {
+			return -1;
+		}
+
+		p    += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+
+
+static int readAll(int fd, void* data, size_t size) {
+	uint8_t* p = data;
+
+	while(size) {
+		ssize_t n = read(fd, p, size);
+
+		if(n <= 0) {
+			return -1;
+		}
+
+		p    += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+
+
+/**
+ * \brief Collects traces for one worker
+ *
+ * \param classes Fixed (0) and random (1) class statistics.
+ * \param totals Totals, zeroed by the caller.
+ * \param count Number of traces.
+ * \param key Fixed key.
+ * \param fixed Fixed plaintext.
+ */
+static void collect(tvla_class_t* classes, tvla_totals_t* totals, uint64_t count, uint8_t* key, uint8_t* fixed) {
+	aes256_ctx_t ctx;
+	uint8_t      block[16];
+
+	aes256_init(key, &ctx);
+
+	for(uint64_t i = 0; i < count; i++) {
+		uint8_t random = rng() & 1;
+
+		if(random) {
+			rngFill(block, 16);
+		}
+		else {
+			memcpy(block, fixed, 16);
+		}
+
+		tracePos = 0;
+
+		aes256_enc(block, &ctx);
+
+		// Short traces are padded with noise
+		for(uint32_t j = tracePos; j < window; j++) {
+			trace[j] = noise * gaussian();
+		}
+
+		totals->samples += tracePos;
+		totals->traces++;
+
+		classAdd(&classes[random]);
+	}
+}
+
+
+
+static void usage(const char* name) {
+	fprintf(stderr,
+		"usage: %s [-n traces] [-j processes] [-w samples] [-s noise] [-r seed] [-o t.csv]\n",
+		name);
+}
+
+
+
+int main(int argc, char** argv) {
+	uint64_t      total   = 100000;
+	uint64_t      seed    = time(NULL);
+	long          workers = sysconf(_SC_NPROCESSORS_ONLN);
+	const char*   out     = NULL;
+	uint8_t       key[32], fixed[16];
+	tvla_class_t  classes[2], other;
+	tvla_totals_t totals, result;
+	int           fds[MAX_WORKERS][2];
+	int           opt;
+	uint64_t      start;
+
+	while((opt = getopt(argc, argv, "n:j:w:s:r:o:")) != -1) {
+		switch(opt) {
+			case 'n': total   = strtoull(optarg, NULL, 0); break;
+			case 'j': workers = strtol(optarg, NULL, 0);   break;
+			case 'w': window  = strtoul(optarg, NULL, 0);  break;
+			case 's': noise   = strtod(optarg, NULL);      break;
+			case 'r': seed    = strtoull(optarg, NULL, 0); break;
+			case 'o': out     = optarg;                    break;
+			default:  usage(argv[0]);                      return 2;
+		}
+	}
+
+	if(total < 2 || window == 0 || noise < 0 || optind != argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if(workers < 1) {
+		workers = 1;
+	}
+
+	if(workers > MAX_WORKERS) {
+		workers = MAX_WORKERS;
+	}
+
+	trace = malloc(window * sizeof(double));
+
+	if(!trace || !classAlloc(&classes[0]) || !classAlloc(&classes[1]) || !classAlloc(&other)) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+
+	// Key and fixed plaintext are shared by all workers
+	rngState = (seed + 1) * 0x9E3779B97F4A7C15ULL;
+	rngFill(key, sizeof(key));
+	rngFill(fixed, sizeof(fixed));
+
+#if defined(AES_ENC_MSBOX)
+	printf("Host TVLA, masked S-box AES kernel, ");
+#else
+	printf("Host TVLA, C AES kernel, ");
+#endif
+
+#if SCP_PROFILE == SCP_NONE
+	printf("SCP profile: none\n");
+#elif SCP_PROFILE == SCP_BASIC
+	printf("SCP profile: basic\n");
+#else
+	printf("SCP profile: full\n");
+#endif
+
+	printf("%llu traces on %ld processes, %u samples, noise %.2f, seed %llu\n",
+		(unsigned long long)total, workers, window, noise, (unsigned long long)seed);
+	fflush(stdout);
+
+	start = now();
+
+	for(long w = 0; w < workers; w++) {
+		if(pipe(fds[w])) {
+			perror("pipe");
+			return 2;
+		}
+
+		pid_t pid = fork();
+
+		if(pid < 0) {
+			perror("fork");
+			return 2;
+		}
+
+		if(pid == 0) {
+			close(fds[w][0]);
+
+			memset(&result, 0, sizeof(result));
+			rngState = (seed + 1) * 0x9E3779B97F4A7C15ULL + w + 1;
+			rng();
+			randSeed = rng();
+
+			collect(classes, &result, total / workers + (w < (long)(total % workers)), key, fixed);
+
+			if(writeAll(fds[w][1], &result, sizeof(result))) {
+				_exit(2);
+			}
+
+			for(int c = 0; c < 2; c++) {
+				if(writeAll(fds[w][1], &classes[c].n, sizeof(uint64_t)) ||
+				   writeAll(fds[w][1], classes[c].mean, window * sizeof(double)) ||
+				   writeAll(fds[w][1], classes[c].m2, window * sizeof(double))) {
+					_exit(2);
+				}
+			}
+
+			_exit(0);
+		}
+
+		close(fds[w][1]);
+	}
+
+	memset(&totals, 0, sizeof(totals));
+
+	for(long w = 0; w < workers; w++) {
+		if(readAll(fds[w][0], &result, sizeof(result))) {
+			fprintf(stderr, "worker %ld did not report\n", w);
+			return 2;
+		}
+
+		for(int c = 0; c < 2; c++) {
+			if(readAll(fds[w][0], &other.n, sizeof(uint64_t)) ||
+			   readAll(fds[w][0], other.mean, window * sizeof(double)) ||
+			   readAll(fds[w][0], other.m2, window * sizeof(double))) {
+				fprintf(stderr, "worker %ld did not report\n", w);
+				return 2;
+			}
+
+			classMerge(&classes[c], &other);
+		}
+
+		close(fds[w][0]);
+
+		totals.traces  += result.traces;
+		totals.samples += result.samples;
+	}
+
+	while(wait(NULL) > 0) {
+	}
+
+
+
+	/* WELCH T-TEST */
+
+	FILE*    csv     = out ? fopen(out, "w") : NULL;
+	double   maxT    = 0;
+	uint32_t maxAt   = 0;
+	uint32_t leaking = 0;
+
+	if(out && !csv) {
+		perror(out);
+		return 2;
+	}
+
+	if(csv) {
+		fprintf(csv, "sample,t\n");
+	}
+
+	for(uint32_t i = 0; i < window; i++) {
+		double v0 = classes[0].n > 1 ? classes[0].m2[i] / (classes[0].n - 1) : 0;
+		double v1 = classes[1].n > 1 ? classes[1].m2[i] / (classes[1].n - 1) : 0;
+		double se = (classes[0].n && classes[1].n) ? sqrt(v0 / classes[0].n + v1 / classes[1].n) : 0;
+		double t  = se > 0 ? (classes[0].mean[i] - classes[1].mean[i]) / se : 0;
+
+		if(fabs(t) > fabs(maxT)) {
+			maxT  = t;
+			maxAt = i;
+		}
+
+		if(fabs(t) > TVLA_THRESHOLD) {
+			leaking++;
+		}
+
+		if(csv) {
+			fprintf(csv, "%u,%.4f\n", i, t);
+		}
+	}
+
+	if(csv) {
+		fclose(csv);
+	}
+
+	printf("fixed %llu, random %llu traces in %.2f s\n",
+		(unsigned long long)classes[0].n, (unsigned long long)classes[1].n, (now() - start) / 1e9);
+	printf("cost: %.1f samples per block\n", (double)totals.samples / totals.traces);
+	printf("leakage: max |t| %.2f at sample %u, %u of %u samples above %.1f\n",
+		fabs(maxT), maxAt, leaking, window, TVLA_THRESHOLD);
+
+	return leaking ? 1 : 0;
+}
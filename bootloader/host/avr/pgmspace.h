@@ -0,0 +1,28 @@
+/*
+ * Host build stand-in for <avr/pgmspace.h>. Only compiled in by make host.
+ *
+ * Program memory is ordinary memory on the host, so PROGMEM tables are read
+ * through plain pointers. Far addresses below HAL_FLASH_SIZE are flash
+ * addresses, as used by the flash CFB/CTR functions, and read from hal_flash
+ * instead. No host object lives that low.
+ */
+
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#include "hal.h"
+
+#define PROGMEM
+#define PGM_P      const char*
+#define PGM_VOID_P const void*
+
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+
+#define pgm_read_byte_far(address) hal_read_byte_far((uintptr_t)(address))
+#define pgm_read_word_far(address) hal_read_word_far((uintptr_t)(address))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
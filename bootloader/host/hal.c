@@ -0,0 +1,96 @@
+/*
+ * Host build hardware abstraction. Only compiled in by make host.
+ *
+ * quickRand() is the same LFSR as on the device, so every SCP profile draws
+ * the same random numbers and does the same work. switchClock() cannot change
+ * the host clock; it only counts the calls and draws its random bit.
+ */
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "AES_lib/aes_scp.h"
+
+
+
+/*** VARIABLES ***/
+
+uint8_t  hal_flash[HAL_FLASH_SIZE];
+
+uint32_t hal_rand_count   = 0;
+uint32_t hal_switch_count = 0;
+
+uint16_t randSeed  = 0xACE1;
+uint8_t  fastClock = 1;
+
+
+
+/*** FUNCTION BODIES ***/
+
+/**
+ * \brief Reads a byte of program memory
+ *
+ * \param address Flash address below HAL_FLASH_SIZE, or host address of a PROGMEM object.
+ * \return Byte read.
+ */
+uint8_t hal_read_byte_far(uintptr_t address) {
+	if(address < HAL_FLASH_SIZE) {
+		return hal_flash[address];
+	}
+	
+	return *(const uint8_t*)address;
+}
+
+
+
+/**
+ * \brief Reads a little endian word of program memory
+ *
+ * \param address Flash address below HAL_FLASH_SIZE, or host address of a PROGMEM object.
+ * \return Word read.
+ */
+uint16_t hal_read_word_far(uintptr_t address) {
+	return hal_read_byte_far(address) | ((uint16_t)hal_read_byte_far(address + 1) << 8);
+}
+
+
+
+/**
+ * \brief Clears the operation counters
+ */
+void hal_clear_counts(void) {
+	hal_rand_count   = 0;
+	hal_switch_count = 0;
+}
+
+
+
+/**
+ * \brief Same 16-bit Galois LFSR as quickRand() in main.c
+ */
+uint16_t quickRand(uint16_t* seed) {
+	hal_rand_count++;
+	
+	*seed >>= 1;
+	
+	uint8_t lsb = *seed & 1;
+	
+	*seed ^= (-lsb) & 0xB400u;
+	
+	return *seed;
+}
+
+
+
+/**
+ * \brief Counts a clock switch. Draws the same random bit as switchClock() in main.c
+ */
+void switchClock(void) {
+	hal_switch_count++;
+	
+#if SCP_CLOCK_SWITCH
+	if(quickRand(&randSeed) % 2) {
+		fastClock = !fastClock;
+	}
+#endif
+}
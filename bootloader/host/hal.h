@@ -0,0 +1,33 @@
+/*
+ * Host build hardware abstraction. Only compiled in by make host.
+ *
+ * Provides what AES_lib expects from the AVR toolchain and from main.c:
+ * far flash reads, the random seed, quickRand() and switchClock().
+ */
+
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+
+// Emulated flash of the ATmega1284P, read by pgm_read_byte_far()
+#define HAL_FLASH_SIZE 0x20000UL
+
+extern uint8_t hal_flash[HAL_FLASH_SIZE];
+
+// Operation counters, cleared with hal_clear_counts()
+extern uint32_t hal_rand_count;
+extern uint32_t hal_switch_count;
+
+// Defined in main.c on the device
+extern uint16_t randSeed;
+extern uint8_t  fastClock;
+uint16_t quickRand(uint16_t* seed);
+void switchClock(void);
+
+uint8_t  hal_read_byte_far(uintptr_t address);
+uint16_t hal_read_word_far(uintptr_t address);
+void     hal_clear_counts(void);
+
+#endif /* HAL_H_ */
@@ -0,0 +1,158 @@
+/*
+ * LZSS decompressor. Only compiled in when IMAGE_LZSS is defined (make COMPRESS=1).
+ *
+ * Stream format, written by host_tools/lzss.py: a flag byte, then the 8 items it
+ * describes, least significant bit first. A set bit is a literal byte. A clear
+ * bit is a 2-byte big-endian match, (offset - 1) << LZSS_LENGTH_BITS | (length -
+ * LZSS_MIN_MATCH), copying length bytes starting offset bytes back in the output.
+ * The length may exceed the offset, which repeats the last offset bytes.
+ *
+ * Offsets only reach back LZSS_WINDOW_SIZE bytes, so the decompressor keeps that
+ * much of the output in a ring buffer and never reads back from flash. Nothing
+ * marks the end of the stream: the caller reads as many bytes as it expects.
+ */
+
+#ifdef IMAGE_LZSS
+
+#include <stdint.h>
+
+#include "lzss.h"
+
+
+
+/*** FUNCTION BODIES ***/
+
+/**
+ * \brief Starts decompressing a stream
+ *
+ * The window starts out zeroed, as in the compressor.
+ *
+ * \param ctx Pointer to the context to be started.
+ */
+void strtLZSS(lzss_ctx_t* ctx) {
+	for(uint16_t i = 0; i < LZSS_WINDOW_SIZE; i++) {
+		ctx->window[i] = 0x00;
+	}
+
+	ctx->head      = 0;
+	ctx->inSize    = 0;
+	ctx->flagCount = 0;
+	ctx->split     = 0;
+	ctx->matchLeft = 0;
+}
+
+
+
+/**
+ * \brief Gives the next part of the compressed stream to the decompressor
+ *
+ * The buffer must stay untouched until readLZSS() has read all of it, which is
+ * when it returns less than was asked for.
+ *
+ * \param ctx Pointer to a context started with strtLZSS().
+ * \param data Next part of the compressed stream.
+ * \param size Size of data, in bytes.
+ */
+void feedLZSS(lzss_ctx_t* ctx, uint8_t* data, uint16_t size) {
+	ctx->in     = data;
+	ctx->inSize = size;
+}
+
+
+
+/**
+ * \brief Decompresses up to size bytes
+ *
+ * Stops early when the input given to feedLZSS() runs out. A match or flag byte
+ * cut off by the end of the input is kept in the context and finished with the
+ * next input.
+ *
+ * \param ctx Pointer to a context started with strtLZSS().
+ * \param output Array that will hold the decompressed bytes.
+ * \param size Number of bytes wanted.
+ * \return Number of bytes written to output.
+ */
+uint16_t readLZSS(lzss_ctx_t* ctx, uint8_t* output, uint16_t size) {
+	uint16_t count = 0;
+	uint8_t  byte;
+
+	while(count < size) {
+		if(ctx->matchLeft) {
+			// Copy from the window
+			byte = ctx->window[(ctx->head - ctx->matchOffset) & LZSS_WINDOW_MASK];
+			ctx->matchLeft--;
+		}
+		else if(!ctx->inSize) {
+			break;
+		}
+		else if(!ctx->flagCount) {
+			ctx->flags     = *ctx->in++;
+			ctx->flagCount = 8;
+			ctx->inSize--;
+			continue;
+		}
+		else if(ctx->flags & 1) {
+			// Literal
+			byte = *ctx->in++;
+			ctx->inSize--;
+			ctx->flags >>= 1;
+			ctx->flagCount--;
+		}
+		else if(!ctx->split) {
+			// First byte of a match
+			ctx->token = *ctx->in++;
+			ctx->inSize--;
+			ctx->split = 1;
+			continue;
+		}
+		else {
+			uint16_t match = ((uint16_t)ctx->token << 8) | *ctx->in++;
+
+			ctx->inSize--;
+			ctx->split = 0;
+			ctx->flags >>= 1;
+			ctx->flagCount--;
+
+			ctx->matchOffset = (match >> LZSS_LENGTH_BITS) + 1;
+			ctx->matchLeft   = (match & LZSS_LENGTH_MASK) + LZSS_MIN_MATCH;
+			continue;
+		}
+
+		ctx->window[ctx->head] = byte;
+		ctx->head = (ctx->head + 1) & LZSS_WINDOW_MASK;
+
+		output[count++] = byte;
+	}
+
+	return count;
+}
+
+
+
+/**
+ * \brief Checks that a stream ends where its output does
+ *
+ * Called once all the expected bytes are read. The stream is padded with zero
+ * bytes to the end of its last input buffer, so that is all that may be left.
+ *
+ * \param ctx Pointer to a context started with strtLZSS().
+ * \return 1 if only zero padding is left of the input, 0 otherwise.
+ */
+uint8_t endLZSS(lzss_ctx_t* ctx) {
+	// A match or item cut off by the end of the output
+	if(ctx->matchLeft || ctx->split) {
+		return 0;
+	}
+
+	while(ctx->inSize) {
+		if(*ctx->in++) {
+			return 0;
+		}
+
+		ctx->inSize--;
+	}
+
+	return 1;
+}
+
+#endif /* IMAGE_LZSS */
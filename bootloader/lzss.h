@@ -0,0 +1,41 @@
+/*
+ * LZSS decompressor headers. Used for compressed firmware images (make COMPRESS=1).
+ */
+
+
+#ifndef LZSS_H_
+#define LZSS_H_
+
+#include <stdint.h>
+
+// Window of back-references: 2^LZSS_WINDOW_BITS bytes of RAM
+#define LZSS_WINDOW_BITS 10
+#define LZSS_WINDOW_SIZE (1U << LZSS_WINDOW_BITS)
+#define LZSS_WINDOW_MASK (LZSS_WINDOW_SIZE - 1)
+
+// A match is 2 bytes: offset - 1 (LZSS_WINDOW_BITS) and length - LZSS_MIN_MATCH (LZSS_LENGTH_BITS)
+#define LZSS_LENGTH_BITS (16 - LZSS_WINDOW_BITS)
+#define LZSS_LENGTH_MASK ((1U << LZSS_LENGTH_BITS) - 1)
+#define LZSS_MIN_MATCH   3
+
+// Holds the window and the position in the stream, so input and output can be split anywhere.
+typedef struct {
+	uint8_t  window[LZSS_WINDOW_SIZE];
+	uint16_t head;        // Next window position written
+	uint8_t* in;          // Input not read yet
+	uint16_t inSize;
+	uint8_t  flags;       // Flag byte, one bit per item, shifted as items are read
+	uint8_t  flagCount;   // Items left under the flag byte
+	uint8_t  token;       // First byte of a match, when the second is in the next input
+	uint8_t  split;
+	uint16_t matchOffset;
+	uint8_t  matchLeft;   // Bytes of the current match not output yet
+} lzss_ctx_t;
+
+// Decompresses a stream input buffer by input buffer, into output buffers of any size.
+void strtLZSS(lzss_ctx_t* ctx);
+void feedLZSS(lzss_ctx_t* ctx, uint8_t* data, uint16_t size);
+uint16_t readLZSS(lzss_ctx_t* ctx, uint8_t* output, uint16_t size);
+uint8_t endLZSS(lzss_ctx_t* ctx);
+
+#endif /* LZSS_H_ */
@@ -53,11 +53,14 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <avr/eeprom.h>
+#include <stdlib.h>
 
 #include "uart.h"
 #include "AES_lib.h"
 #include "secret_build_output.txt"
 #include "eeprom_safe.h"
+#include "benchmark.h"
+#include "lzss.h"
 
 
 
@@ -73,14 +76,33 @@ void switchClock(void);
 
 // Bootloader Functionality
 void load_firmware(void);
+void refuse_update(char* reason);
 void boot_firmware(void);
 void readback(void);
 void configure(void);
 
 // Generic
 void loadSecrets(void);
-void calcHash(uint8_t* key, uint16_t startPage, uint16_t endPage, uint8_t* hash);
+void calcHash(hashCBC_ctx_t* ctx, uint16_t startPage, uint16_t endPage);
 void program_flash(uint32_t page_address, unsigned char *data);
+void erase_flash(uint32_t page_address);
+void write_flash(uint32_t page_address, unsigned char *data);
+void poll_flash(void);
+void wait_flash(void);
+
+// Firmware Update Header
+uint8_t parse_header(uint8_t* header, uint8_t* pageMap, uint16_t* pageCount);
+uint8_t page_sent(uint8_t* pageMap, uint8_t page);
+uint8_t next_page(uint8_t* pageMap, uint8_t page);
+uint16_t check_version(uint8_t* versionPage);
+void install_page(uint8_t page, uint8_t* data);
+
+// Application Slots
+uint32_t slot_address(uint8_t slot, uint8_t page);
+void sync_vectors(void);
+#ifdef IMAGE_LZSS
+uint8_t store_page(lzss_ctx_t* ctx, uint8_t compressed, uint8_t* data, uint8_t* pageMap, uint8_t page, uint8_t* output, uint16_t* fill);
+#endif
 
 
 
@@ -102,18 +124,67 @@ void program_flash(uint32_t page_address, unsigned char *data);
 // Load Firmware Message Size (in PAGES)
 #define LOAD_FIRMWARE_PAGE_NUMBER 126UL
 
-// Readback Request Size (in bytes)
-#define READBACK_REQUEST_SIZE 48UL
-
-// Section Start Address Locations (in bytes)
+// Firmware Image Size (in PAGES): version page, message pages and firmware pages
+#define IMAGE_PAGE_NUMBER (LOAD_FIRMWARE_PAGE_NUMBER - 1)
+
+// Header Page of a firmware update (in bytes, see load_firmware())
+#define HEADER_COUNT     0
+#define HEADER_MAP       2
+#define HEADER_MAP_SIZE  16
+#define HEADER_NONCE     (HEADER_MAP + HEADER_MAP_SIZE)
+#define HEADER_BASE      (HEADER_NONCE + 12)
+#define HEADER_SLOT      (HEADER_BASE + 2)
+#define HEADER_AUTH_SIZE (HEADER_SLOT + 1)
+
+// Page Count flag for compressed images, in its high byte
+#define HEADER_LZSS      0x80
+
+// Image pages that are always sent: version page and message pages
+#define REQUIRED_PAGE_NUMBER 5
+
+// Readback Request Size (in bytes). CTR readback requests carry a nonce block
+// between the encrypted request and its MAC.
+#define READBACK_CIPHERTEXT_SIZE 32UL
+#ifdef READBACK_CTR
+#define READBACK_REQUEST_SIZE (READBACK_CIPHERTEXT_SIZE + 2 * BLOCK_SIZE)
+#else
+#define READBACK_REQUEST_SIZE (READBACK_CIPHERTEXT_SIZE + BLOCK_SIZE)
+#endif
+
+// Application Slots. The firmware runs from one of two slots, and updates are installed to
+// the other one. Each slot holds an APPLICATION_SECTION, a MESSAGE_SECTION and, in slot 0,
+// the VECTOR_HOME page (see slot_address()). Firmware is linked for the slot it runs from.
+#define SLOT_NUMBER         2
+#define SLOT_SECTION(slot)  ((uint32_t)(slot) * LOAD_FIRMWARE_PAGE_NUMBER * SPM_PAGESIZE)
+#define UPDATE_SLOT         (activeSlot ^ 1)
+
+// Section Start Address Locations (in bytes). The first three are within a slot.
 #define APPLICATION_SECTION 0UL * LOAD_FIRMWARE_PAGE_NUMBER * SPM_PAGESIZE
 #define MESSAGE_SECTION     1UL * (LOAD_FIRMWARE_PAGE_NUMBER - 6) * SPM_PAGESIZE
-#define ENCRYPTED_SECTION	1UL * LOAD_FIRMWARE_PAGE_NUMBER * SPM_PAGESIZE
-#define DECRYPTED_SECTION	2UL * LOAD_FIRMWARE_PAGE_NUMBER * SPM_PAGESIZE
+#define VECTOR_HOME         1UL * (LOAD_FIRMWARE_PAGE_NUMBER - 2) * SPM_PAGESIZE
+#define ENCRYPTED_SECTION	2UL * LOAD_FIRMWARE_PAGE_NUMBER * SPM_PAGESIZE
 #define BOOTLDR_SECTION		480UL * SPM_PAGESIZE
 
+// Background Flash Programming Steps, see write_flash()
+#define FLASH_IDLE  0  // Nothing running, the RWW section can be read
+#define FLASH_ERASE 1  // Page Erase running, Page Write follows
+#define FLASH_WRITE 2  // Last step running, the RWW section is enabled next
+
 // Bootloader Control Flags
 uint16_t fw_version EEMEM         = 1;
+uint16_t fw_installed[SLOT_NUMBER] EEMEM = {0, 0};  // Version in each slot, 0 if unknown
+uint8_t  activeSlotEE EEMEM       = 0;  // Slot booted, written last by an update
+uint8_t  activeSlot               = 0;
+uint16_t imageVersion             = 0;  // Version of the update being installed
+#ifdef IMAGE_CCM
+uint8_t  stagedVersion[2]         = {0, 0};  // Version Number, until the tag is checked
+#endif
+#ifdef BENCHMARK
+uint16_t flashWritten             = 0;  // Flash pages erased or programmed, see write_flash()
+uint16_t flashSkipped             = 0;  // Flash pages that already held the right data
+#endif
+uint8_t  flashState               = FLASH_IDLE;  // Page being programmed, see write_flash()
+uint32_t flashAddress             = 0;
 uint8_t  fastClock			  	  = 1;
 uint8_t  bootConfiguredEE	EEMEM = 0;
 uint8_t  bootConfigured           = 0;
@@ -128,6 +199,14 @@ uint8_t readbackHashKey[KEY_SIZE] = /*PC_RBH_KEY; //*/ {0, 0, 0, 0, 0, 0, 0, 0,
 uint8_t firmwareKey[KEY_SIZE]     = /*PC_FW_KEY; //*/ {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 uint8_t readbackKey[KEY_SIZE]     = /*PC_RB_KEY; //*/ {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
+#ifdef DEVICE_KEYS
+// Firmware image MAC key, derived per device. hashKey stays shared for configure.
+uint8_t imageHashKey[KEY_SIZE]    = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+#define IMAGE_HASH_KEY imageHashKey
+#else
+#define IMAGE_HASH_KEY hashKey
+#endif
+
 // Initialization Vectors
 uint8_t firmwareIV[BLOCK_SIZE] = FW_IV;
 uint8_t readbackIV[BLOCK_SIZE] = RB_IV;
@@ -138,9 +217,17 @@ uint8_t readbackPassword[READBACK_PASSWORD_SIZE] = /*PC_RB_PW; //*/{0, 0, 0, 0,
 // AES-256 Keys (In EEPROM)
 uint8_t hashKeyEE[2 * KEY_SIZE] EEMEM	      = H_KEY;
 uint8_t readbackHashKeyEE[2 * KEY_SIZE] EEMEM = RBH_KEY;
-uint8_t firmwareKeyEE[2 * KEY_SIZE] EEMEM	  = FW_KEY;
 uint8_t readbackKeyEE[2 * KEY_SIZE] EEMEM	  = RB_KEY;
 
+#ifdef DEVICE_KEYS
+// Device key and ID (In EEPROM), rewritten per device by bl_provision. The
+// firmware image keys are derived from them, so the shared FW_KEY is not stored.
+uint8_t deviceKeyEE[2 * KEY_SIZE] EEMEM   = DEV_KEY;
+uint8_t deviceIdEE[KDF_ID_SIZE] EEMEM     = DEVICE_ID;
+#else
+uint8_t firmwareKeyEE[2 * KEY_SIZE] EEMEM	  = FW_KEY;
+#endif
+
 // Passwords (In EEPROM)
 uint8_t readbackPasswordEE[2 * READBACK_PASSWORD_SIZE] EEMEM = RB_PW;
 
@@ -214,6 +301,11 @@ int main(void) {
 	// Otherwise, boot
 	else
 	{
+#ifdef BENCHMARK
+		// Benchmark build, report timings on UART0 before booting
+		loadSecrets();
+		benchmark();
+#endif
 		UART1_putchar('B');
 		boot_firmware();
 	}
@@ -292,6 +384,8 @@ ISR(INT0_vect) {
  */
 void configure(void) {
 	uint8_t hash[BLOCK_SIZE] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+	
+	hashCBC_ctx_t hashCtx;
 		
 	//Start the Watchdog Timer
 	wdt_enable(WDTO_4S);
@@ -375,7 +469,9 @@ void configure(void) {
 	
 	/* CALCULATE HASH */
 
-		calcHash(hashKey, BOOTLDR_SECTION/SPM_PAGESIZE, BOOTLDR_SECTION/SPM_PAGESIZE + 32, hash);
+		strtHashCBC(hashKey, &hashCtx);
+		calcHash(&hashCtx, BOOTLDR_SECTION/SPM_PAGESIZE, BOOTLDR_SECTION/SPM_PAGESIZE + 32);
+		endHashCBC(&hashCtx, hash);
 
 		wdt_reset();
 		
@@ -419,6 +515,10 @@ void configure(void) {
  *
  * [Readback Password] [Start Address] [End Address]
  *
+ * The addresses are relative to the application slot the firmware runs from, so
+ * address 0 is the first byte of the running firmware in either slot. Neither the
+ * other slot, which may hold a refused update, nor the Message Pages are read back.
+ *
  * Although the addresses are byte-addressable, this function will dump flash pages
  * (each of which is 256 bytes). The function will begin returning the page containing
  * the starting address, and finish returning the page returning the ending address.
@@ -444,12 +544,21 @@ void configure(void) {
  *		IF INCORRECT - The bootloader terminates
  *
  * 5 - The bootloader reads in the start address and end address and converts them to
- *	   start page and end page. The end page is truncated to the page before the
- *	   BOOTLOADER_SECTION. 
+ *	   start page and end page. Both are truncated to the last page of the
+ *	   APPLICATION_SECTION of the active slot.
  *
  * 6 - The bootloader begins reading the flash data a page at a time. Each page is encrypted
  *	   using AES-256 in CFB mode using the Readback Key and IV before being sent to PC.
  *
+ * When built with READBACK=ctr, a random 16-byte nonce block follows the encrypted request
+ * and is covered by its CBC-MAC:
+ *
+ * [Encrypted Request] [Nonce] [Request MAC]
+ *
+ * Each page is then encrypted using AES-256 in CTR mode, with the first CTR_NONCE_SIZE bytes
+ * of the nonce and a counter derived from the page number in the slot. The PC can decrypt
+ * any page on its own, without replaying the pages before it.
+ *
  */
 void readback(void)
 {
@@ -459,20 +568,27 @@ void readback(void)
 	uint16_t endPage      = 0;
 	
 	uint8_t  readbackRequest[READBACK_REQUEST_SIZE];
-	uint8_t  decryptdRequest[READBACK_REQUEST_SIZE - BLOCK_SIZE];
+	uint8_t  decryptdRequest[READBACK_CIPHERTEXT_SIZE];
 	uint8_t  hash[BLOCK_SIZE]  = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
-	uint8_t blockBuffer[BLOCK_SIZE];
-	uint8_t pageBuffer[SPM_PAGESIZE];
 	uint8_t encryptedBuffer[SPM_PAGESIZE];
 	
-	aes256_ctx_t ctx;
+	aes256_lean_ctx_t ctx;
+#ifdef READBACK_CTR
+	pageCTR_ctx_t flashCtx;
+#else
+	flashCFB_ctx_t flashCtx;
+#endif
+	hashCBC_lean_ctx_t hashCtx;
 	
     // Start the Watchdog Timer
     wdt_enable(WDTO_4S);
 	
 	setFastMode();
 	
+	// Only the running firmware is read back
+	activeSlot = eeprom_read_byte(&activeSlotEE) & 1;
+	
 	// Wait for data
 	while(!UART1_data_available()) {
 		__asm__ __volatile__("");
@@ -488,7 +604,9 @@ void readback(void)
 
 	/* COMPUTE HASH */
 	
-	hashCBC(readbackHashKey, readbackRequest, hash, READBACK_REQUEST_SIZE - BLOCK_SIZE);
+	strtHashCBCLean(readbackHashKey, &hashCtx);
+	contHashCBCLean(&hashCtx, readbackRequest, READBACK_REQUEST_SIZE - BLOCK_SIZE);
+	endHashCBCLean(&hashCtx, hash);
 
 
 
@@ -510,12 +628,12 @@ void readback(void)
 	
 	/* DECRYPT MESSAGE */
 	
-	for(int i = 0; i < (READBACK_REQUEST_SIZE - BLOCK_SIZE); i += BLOCK_SIZE) {
+	for(int i = 0; i < READBACK_CIPHERTEXT_SIZE; i += BLOCK_SIZE) {
 		if(i == 0) {
-			strtDecCFB(readbackKey, &readbackRequest[i], readbackIV, &ctx, &decryptdRequest[i]);
+			strtDecCFBLean(readbackKey, &readbackRequest[i], readbackIV, &ctx, &decryptdRequest[i]);
 		}
 		else {
-			contDecCFB(&ctx, &readbackRequest[i], &readbackRequest[i - BLOCK_SIZE], &decryptdRequest[i]);
+			contDecCFBLean(&ctx, &readbackRequest[i], &readbackRequest[i - BLOCK_SIZE], &decryptdRequest[i]);
 		}
 		
 		switchClock();
@@ -559,14 +677,14 @@ void readback(void)
 	endPage   = (startAddress + size - 1) / SPM_PAGESIZE;
 	
 	for(int i = 0; i < 16; i++) {
-		// If start page is outside application section, truncate
+		// If start page is outside the application section, truncate
 		if(startPage > ((MESSAGE_SECTION / SPM_PAGESIZE) - 1)) {
 			startPage = (MESSAGE_SECTION / SPM_PAGESIZE) - 1;
 		}
 	
 		switchClock();
 		
-		// If end page is outside application section, truncate
+		// If end page is outside the application section, truncate
 		if(endPage > ((MESSAGE_SECTION / SPM_PAGESIZE) - 1)) {
 			endPage = (MESSAGE_SECTION / SPM_PAGESIZE) - 1;
 		}
@@ -580,34 +698,22 @@ void readback(void)
 	
 	// Unlike the other for loops in this format, this one terminates if j > endPage, not if j >= endPage.
 	// Pay attention to this.
+#ifdef READBACK_CTR
+	strtCTR(readbackKey, &readbackRequest[READBACK_CIPHERTEXT_SIZE], &flashCtx);
+#else
+	strtFlashCFB(readbackKey, readbackIV, &flashCtx);
+#endif
+	
 	for(int j = startPage; j <= endPage; j++) {
 		
-		// Reads page
-		for(int i = 0; i < SPM_PAGESIZE; i++) {
-			pageBuffer[i] = pgm_read_byte_far((uint32_t)j * SPM_PAGESIZE + i);
-		}
-		
 		wdt_reset();
 		
-		// Encrypts page
-		for(int i = 0; i < SPM_PAGESIZE; i += BLOCK_SIZE) {
-			if((j == startPage) && (i == 0)) {
-				strtEncCFB(readbackKey, &pageBuffer[i], readbackIV, &ctx, &encryptedBuffer[i]);
-			}
-			else if(i == 0) {
-				contEncCFB(&ctx, &pageBuffer[i], blockBuffer, &encryptedBuffer[i]);
-			}
-			else {
-				contEncCFB(&ctx, &pageBuffer[i], &encryptedBuffer[i - BLOCK_SIZE], &encryptedBuffer[i]);
-			}
-			
-			switchClock();
-		}
-			
-		// Save data for next page
-		for(int i = 0; i < BLOCK_SIZE; i++) {
-			blockBuffer[i] = encryptedBuffer[SPM_PAGESIZE - BLOCK_SIZE + i];
-		}
+		// Encrypts page straight from flash
+#ifdef READBACK_CTR
+		cryptFlashCTR(&flashCtx, j, SLOT_SECTION(activeSlot) + (uint32_t)j * SPM_PAGESIZE, encryptedBuffer, SPM_PAGESIZE);
+#else
+		encFlashCFB(&flashCtx, SLOT_SECTION(activeSlot) + (uint32_t)j * SPM_PAGESIZE, encryptedBuffer, SPM_PAGESIZE);
+#endif
 		
 		// Print data
 		for(int i = 0; i < SPM_PAGESIZE; i++) {
@@ -632,15 +738,44 @@ void readback(void)
  * This function securely loads a new firmware image onto flash. Firmware is encrypted using
  * AES-256 in CFB Mode, and sent one page at a time. It is in the following format:
  *
- * --------32000 Bytes-------- ----256 Bytes-----
+ * ---256 Bytes--- ---N * 256 Bytes--- ----256 Bytes-----
+ *
+ * [Header Page]   [Encrypted Pages]   [Message MAC Page]
+ *
+ * The firmware image is IMAGE_PAGE_NUMBER pages, broken into the following pages:
+ *
+ * --256 Bytes--- --1024 Bytes--- --30720 Bytes---
+ *
+ * [Version Page] [Message Pages] [Firmware Pages]
  *
- * [Encrypted Firmware Update] [Message MAC Page]
+ * Only the N pages of the image that are present are encrypted and sent, in order. The Header
+ * Page says which, and is sent in the clear but covered by the MAC. It is constructed in the
+ * following format:
  *
- * The Encrypted Firmware Update section is broken into the following pages:
+ * --2 Bytes--- --16 Bytes-- --12 Bytes-- -----2 Bytes---- --1 Byte-- ---223 Bytes---
  *
- * --256 Bytes--- --30720 Bytes--- --1024 Bytes---
+ * [Page Count] [Page Map]   [Nonce]      [Base Version]   [Slot]     [Padding]
  *
- * [Version Page] [Firmware Pages] [Message Pages]
+ * The Page Count N is 16-bit big endian. Bit j % 8 of byte j / 8 of the Page Map is set if image
+ * page j is sent. The Version and Message Pages are always sent. A Firmware Page that is not sent
+ * is blank, and is erased instead of programmed. The Page Count is in the first block, so the
+ * CBC-MAC only accepts messages of the length it gives. The Nonce is only used by CTR and CCM.
+ *
+ * The firmware runs from one of two application slots, and is linked for the address of its
+ * slot. An update is always installed to the slot that is not active, and the Slot is the one
+ * the firmware is linked for. An image for the active slot is refused before anything is
+ * written. Once the update slot is complete, the one byte activeSlotEE makes it the active
+ * slot, and sync_vectors() points the vectors in page 0 at it. Until then the device boots the
+ * firmware it had, whenever the update stops.
+ *
+ * The Base Version is in the byte order of the Version Number. A Base Version of 0 makes a full
+ * image. Otherwise the image is a delta (fw_delta) that only
+ * carries the Firmware Pages that changed since the Base Version, and the pages not sent are
+ * left as they are. It is refused before anything is written unless the Base Version is the
+ * one in fw_installed for the update slot, the version last written to that slot in full. So a
+ * delta applies to the firmware before the active one. fw_installed is cleared for the slot
+ * while it is written, and by DEBUG firmware (version 0), so a delta never applies on top of an
+ * unknown or half written slot.
  *
  * The version page is constructed in the following format:
  *
@@ -649,8 +784,8 @@ void readback(void)
  * [Version Number] [Random Padding]
  *
  * Each Firmware Page consists of 256 bytes of raw flash. These are obtained via the PC stripping
- * the .hex file generated from the firmware Makefile. Address offsets are added, and blank Flash
- * in the Application Section will be written to 0xFF.
+ * the .hex file generated from the firmware Makefile. Address offsets, from the start of the
+ * slot, are added, and blank Flash in the Application Section will be written to 0xFF.
  *
  * The Message Page is 1024 bytes input by the user at FW_PROTECT time. The string is null
  * terminated, and empty bytes in the Message Section will be written to 0xFF
@@ -663,55 +798,199 @@ void readback(void)
  *
  * The procedure followed is outlined below.
  * 
- * 1 - The encrypted firmware image is loaded into the ENCRYPTED_SECTION of flash.
+ * 1 - The Header Page is checked and added to the CBC-MAC. If it is malformed, the bootloader
+ *	   sends a NACK and terminates. The Encrypted Pages are loaded into the ENCRYPTED_SECTION
+ *	   of flash, and the CBC-MAC is computed one page at a time as the pages arrive.
  *
- * 2 - The CBC-MAC of the encrypted firmware image is computed, and compared to the
- *	   CBC-MAC sent.
+ * 2 - Once the Message MAC Page arrives, the CBC-MAC of the Header Page and Encrypted Pages
+ *	   is compared to the CBC-MAC sent.
+ *
+ *		IF   CORRECT - The bootloader proceeds with the firmware upload.
+ *
+ *		IF INCORRECT - The bootloader terminates and resets at once. The ENCRYPTED_SECTION is
+ *					   left for the next update to overwrite.
+ *
+ * 3 - The pages are decrypted one at a time, from the ENCRYPTED_SECTION to the update
+ *	   slot, each while the one before is programmed. The Version Page comes first and is
+ *	   kept in RAM, where the version number is checked versus the current version, and
+ *	   updated in EEPROM
  *
  *		IF   CORRECT - The bootloader proceeds with the firmware upload.
  *
- *		IF INCORRECT - The bootloader erases ENCRYPTED_SECTION and terminates.
+ *		IF INCORRECT - The bootloader terminates and resets at once. The ENCRYPTED_SECTION is
+ *					   left for the next update to overwrite.
+ *
+ * 4 - The release message is written to the MESSAGE_SECTION, and the firmware to the
+ *	   APPLICATION_SECTION of the update slot, as the pages are decrypted. Each page is
+ *	   written once.
+ *
+ * 5 - The firmware pages not sent are erased, unless the image is a delta. The update slot
+ *	   becomes the active slot, and the bootloader terminates. The ENCRYPTED_SECTION is
+ *	   left as it is, it only holds the ciphertext.
+ *
+ * Built with IMAGE_CCM (make IMAGE=ccm), the pages are encrypted and authenticated with
+ * AES-256 in CCM Mode under the Firmware Key instead:
+ *
+ * ---256 Bytes--- ---N * 256 Bytes--- ---256 Bytes---
+ *
+ * [Header Page]   [Encrypted Pages]   [Tag Page]
+ *
+ * The CCM nonce is the Nonce of the Header Page, and its first HEADER_AUTH_SIZE bytes, up to
+ * the Slot, are the CCM associated data. The Tag Page holds the 16-byte CCM tag followed by
+ * padding. Steps 1 to 4 become:
  *
- * 3 - The firmware image is decrypted and stored in the DECRYPTED_SECTION of flash.
+ * 1 - Each page is decrypted as it arrives, added to the CCM MAC, and written to its place in
+ *	   the update slot, which is not booted until step 4. The Version Number is kept in RAM.
+ *	   The ENCRYPTED_SECTION is not used.
  *
- * 4 - The version number is checked versus the current version, and updated in EEPROM
+ * 2 - Once the Tag Page arrives, the tag is compared to the one sent.
  *
  *		IF   CORRECT - The bootloader proceeds with the firmware upload.
  *
- *		IF INCORRECT - The bootloader erases ENCRYPTED_SECTION and DECRYPTED_SECTION and
- *					   terminate.
+ *		IF INCORRECT - The bootloader terminates and resets at once. fw_installed marks the
+ *					   update slot as holding no firmware, and the next update overwrites it.
  *
- * 5 - The release message is written to the MESSAGE_SECTION
+ * 3 - The version number is checked versus the current version, and updated in EEPROM.
  *
- * 6 - The firmware is written to the APPLICATION_SECTION
+ *		IF   CORRECT - The bootloader proceeds with the firmware upload.
+ *
+ *		IF INCORRECT - The bootloader terminates and resets at once. fw_installed marks the
+ *					   update slot as holding no firmware, and the next update overwrites it.
+ *
+ * 4 - As step 5 above.
  *
- * 7 - The bootloader erases ENCRYPTED_SECTION and DECRYPTED_SECTION and terminates
+ * Built with IMAGE_CTR (make IMAGE=ctr), the image keeps the layout above but is encrypted
+ * with AES-256 in CTR Mode under the Nonce of the Header Page, with the counter derived from
+ * the image page number. In step 3 every page is decrypted on its own.
+ *
+ * Built with IMAGE_LZSS (make COMPRESS=1), the bootloader also takes compressed images, which
+ * have HEADER_LZSS set in the high byte of the Page Count. The present pages are compressed
+ * with LZSS (see lzss.c) before they are encrypted, and the Encrypted Pages are the compressed
+ * stream, zero padded to a page boundary. The Page Count is their number. The Page Map still
+ * gives the image pages present, which are decompressed in order as the pages are decrypted.
+ * In CTR Mode the counter is derived from the position of the page in the stream instead of
+ * the image page number.
+ *
+ * Built with DEVICE_KEYS (make DEVICE_KEYS=1), the firmware key and the image MAC key are
+ * derived from this device's key and ID by loadSecrets(), so an image only installs on the
+ * device it was protected for (fw_protect --devices).
  *
  */
 void load_firmware(void) {
 	uint8_t pageBuffer[SPM_PAGESIZE];
+#if !defined(IMAGE_CCM) || defined(IMAGE_LZSS)
 	uint8_t decryptedBuffer[SPM_PAGESIZE];
-	uint8_t blockBuffer[BLOCK_SIZE];
+#endif
+#ifndef IMAGE_CCM
+	// Ciphertext being decrypted and plaintext being installed, swapped every page
+	uint8_t  cipherBuffer[SPM_PAGESIZE];
+	uint8_t* cipher = cipherBuffer;
+	uint8_t* plain  = decryptedBuffer;
+	uint8_t* swap;
+#endif
 	
 	uint8_t hash[BLOCK_SIZE] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 	
-	uint16_t currentVersion = eeprom_read_word(&fw_version);
-	uint16_t newVersion     = 0x0001;
-	
-	aes256_ctx_t ctx;
+	// Pages sent and version patched by a delta image, from the Header Page
+	uint8_t  pageMap[HEADER_MAP_SIZE];
+	uint16_t pageCount;
+	uint16_t baseVersion;
+	uint8_t  page;
+	
+#ifdef IMAGE_LZSS
+	// Decompressor, and bytes of the current image page decompressed so far
+	lzss_ctx_t lzss;
+	uint16_t   fill = 0;
+	uint8_t    compressed;
+#endif
+	
+#ifdef IMAGE_CCM
+	aeadCCM_ctx_t ctx;
+#elif defined(IMAGE_CTR)
+	pageCTR_ctx_t ctx;
+	hashCBC_lean_ctx_t hashCtx;
+#else
+	flashCFB_ctx_t ctx;
+	hashCBC_lean_ctx_t hashCtx;
+#endif
 	
 	// Start Watchdog Timer
 	wdt_enable(WDTO_4S);
 	
+	activeSlot = eeprom_read_byte(&activeSlotEE) & 1;
 	
 	
-	/* GET UART DATA, CALCULATE HASH */
 	
-	for(int j = 0; j < LOAD_FIRMWARE_PAGE_NUMBER; j++) {
+	/* GET HEADER PAGE */
+	
+	while(!UART1_data_available()) {
+		__asm__ __volatile__("");
+	}
+	
+	wdt_reset();
+	
+	for(int i = 0; i < SPM_PAGESIZE; i++) {
+		pageBuffer[i] = (uint8_t)UART1_getchar();
+	}
+	
+	// Nothing is written yet, so a malformed header only needs a NACK
+	if(!parse_header(pageBuffer, pageMap, &pageCount)) {
+		// DEBUG - Tell us the header failed
+		refuse_update("Header Fail\n");
+	}
+	
+	// Firmware only runs from the slot it is linked for, and the active slot is never written
+	if(pageBuffer[HEADER_SLOT] != UPDATE_SLOT) {
+		// DEBUG - Tell us the image is for the other slot
+		refuse_update("Slot Fail\n");
+	}
+	
+	// Same byte order as the Version Number, so it compares with fw_installed
+	baseVersion = pageBuffer[HEADER_BASE] | ((uint16_t)pageBuffer[HEADER_BASE + 1] << 8);
+	
+	// A delta image only applies on top of the firmware it was made from. That is the one in the
+	// update slot, the release before the running one, which is linked for the other slot.
+	if(baseVersion != 0 && baseVersion != eeprom_read_word(&fw_installed[UPDATE_SLOT])) {
+		// DEBUG - Tell us the base version is wrong
+		refuse_update("Base Fail\n");
+	}
+	
+#ifdef IMAGE_LZSS
+	compressed = pageBuffer[HEADER_COUNT] & HEADER_LZSS;
+#endif
+	
+#ifdef IMAGE_CCM
+	strtCCM(firmwareKey, &pageBuffer[HEADER_NONCE], HEADER_AUTH_SIZE, (uint32_t)pageCount * SPM_PAGESIZE, &ctx);
+	aadCCM(&ctx, pageBuffer, HEADER_AUTH_SIZE);
+#else
+	strtHashCBCLean(IMAGE_HASH_KEY, &hashCtx);
+	contHashCBCLean(&hashCtx, pageBuffer, SPM_PAGESIZE);
+#endif
+	
+#ifdef IMAGE_CTR
+	strtCTR(firmwareKey, &pageBuffer[HEADER_NONCE], &ctx);
+#endif
+	
+	UART1_putchar(ACK);
+	
+	wdt_reset();
+	
+	
+	
+#ifdef IMAGE_CCM
+	/* GET UART DATA, DECRYPT AND CALCULATE TAG */
+	
+	page = next_page(pageMap, 0);
+	
+#ifdef IMAGE_LZSS
+	strtLZSS(&lzss);
+#endif
+	
+	for(int j = 0; j <= pageCount; j++) {
 		
-		// Wait for data
+		// Wait for data, programming the last page meanwhile
 		while(!UART1_data_available()) {
-			__asm__ __volatile__("");
+			poll_flash();
 		}
 		
 		// Reset WDT
@@ -719,12 +998,30 @@ void load_firmware(void) {
 		
 		// Get a page of data
 		for(int i = 0; i < SPM_PAGESIZE; i++) {
+			poll_flash();
+			
 			pageBuffer[i] = (uint8_t)UART1_getchar();
 		}
-	
-		// Write data to Encrypted Section
-		program_flash(ENCRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE, pageBuffer);
- 		
+		
+		// Decrypt and write to its image page in the update slot, except for the Tag Page.
+		// Done before the ACK, as the host does not send the next page until then. The page
+		// is programmed while the next one arrives.
+		if(j < pageCount) {
+			wdt_reset();
+			
+			decCCM(&ctx, pageBuffer, SPM_PAGESIZE);
+			
+			switchClock();
+			
+#ifdef IMAGE_LZSS
+			page = store_page(&lzss, compressed, pageBuffer, pageMap, page, decryptedBuffer, &fill);
+#else
+			install_page(page, pageBuffer);
+			
+			page = next_page(pageMap, page + 1);
+#endif
+		}
+		
 		// Get ready for next page
 		UART1_putchar(ACK);
 		
@@ -732,211 +1029,226 @@ void load_firmware(void) {
 		wdt_reset();
 	}
 	
-	calcHash(hashKey, ENCRYPTED_SECTION / SPM_PAGESIZE, ENCRYPTED_SECTION / SPM_PAGESIZE + LOAD_FIRMWARE_PAGE_NUMBER - 1, hash);
+	wait_flash();
+	
+	endCCM(&ctx, hash);
 	
 	wdt_reset();
-
-
 	
-	/* CHECK HASH */
+	
+	
+	/* CHECK TAG */
 	
 	for(int i = 0; i < BLOCK_SIZE; i++) {
 		switchClock();
 		
-		// If hash is wrong, erase and reset
+		// If tag is wrong, refuse the update
 		if(hash[i] != pageBuffer[i]) {
-			
-			// Send NACK
-			UART1_putchar(NACK);
-			
-			// DEBUG - Tell us hash failed
-			UART0_putstring("Wrong H\n");
-			
-			// Fill pageBuffer with 0xFF
-			for(int i = 0; i < SPM_PAGESIZE; i++) {
-				pageBuffer[i] = 0xFF;
-			}
-			
-			wdt_reset();
-			
-			// Write over Encrypted Section
-			for(int j = 0; j < LOAD_FIRMWARE_PAGE_NUMBER; j++) {
-				program_flash(ENCRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE, pageBuffer);
-				
-				wdt_reset();
-			}
-			
-			// Reset
-			while(1) {
-				__asm__ __volatile__("");
-			}
+			// The update slot holds the unauthenticated plaintext. fw_installed has marked
+			// it as holding no firmware since before its first page was written, so it is
+			// never booted or patched, and the next update overwrites it.
+			// DEBUG - Tell us tag failed
+			refuse_update("Wrong H\n");
 		}
 	}
 	
 	wdt_reset();
-		
 	
+	// Authenticated now, so the version is checked
+	imageVersion = check_version(stagedVersion);
 	
-	/* DECRYPT */
+	wdt_reset();
+#else
+	/* GET UART DATA, CALCULATE HASH */
 	
-	for(int j = 0; j < LOAD_FIRMWARE_PAGE_NUMBER; j++) {
+	for(int j = 0; j <= pageCount; j++) {
 		
-		// Reads page from flash
-		for(int i = 0; i < SPM_PAGESIZE; i++) {
-			pageBuffer[i] = pgm_read_byte_far(ENCRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE + i);
+		// Wait for data, programming the last page meanwhile
+		while(!UART1_data_available()) {
+			poll_flash();
 		}
 		
+		// Reset WDT
 		wdt_reset();
 		
-
+		// Get a page of data
+		for(int i = 0; i < SPM_PAGESIZE; i++) {
+			poll_flash();
+			
+			pageBuffer[i] = (uint8_t)UART1_getchar();
+		}
+	
+		// Write data to Encrypted Section, programmed while the page is hashed and the
+		// next one arrives
+		write_flash(ENCRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE, pageBuffer);
 		
-		// Decrypts page
-		for(int i = 0; i < SPM_PAGESIZE; i += BLOCK_SIZE) {
-			if((j == 0) && (i == 0)) {
-				strtDecCFB(firmwareKey, &pageBuffer[0], firmwareIV, &ctx, &decryptedBuffer[0]);
-			}
-			else if(i == 0) {
-				contDecCFB(&ctx, &pageBuffer[i], blockBuffer, &decryptedBuffer[0]);
-			}
-			else {
-				contDecCFB(&ctx, &pageBuffer[i], &pageBuffer[i - BLOCK_SIZE], &decryptedBuffer[i]);
-			}
+		// Add to hash, except for the Message MAC Page. Done before the ACK, as the
+		// host does not send the next page until then.
+		if(j < pageCount) {
+			wdt_reset();
+			
+			contHashCBCLean(&hashCtx, pageBuffer, SPM_PAGESIZE);
 			
 			switchClock();
 		}
+ 		
+		// Get ready for next page
+		UART1_putchar(ACK);
 		
+		// Reset WDT
 		wdt_reset();
+	}
+	
+	wait_flash();
+	
+	endHashCBCLean(&hashCtx, hash);
+	
+	wdt_reset();
+
+
+	
+	/* CHECK HASH */
+	
+	for(int i = 0; i < BLOCK_SIZE; i++) {
+		switchClock();
 		
-		// Save data for next page
-		for(int i = 0; i < BLOCK_SIZE; i++) {
-			blockBuffer[i] = pageBuffer[SPM_PAGESIZE - BLOCK_SIZE + i];
+		// If hash is wrong, refuse the update
+		if(hash[i] != pageBuffer[i]) {
+			// Nothing but the ciphertext was written, and the next update overwrites it
+			// DEBUG - Tell us hash failed
+			refuse_update("Wrong H\n");
 		}
-		
-		
-		// Writes data to Decrypted Section
-		program_flash(DECRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE, decryptedBuffer);
-		
-		wdt_reset();
 	}
 	
 	wdt_reset();
+		
 	
 	
-	/* CHECK VERSION */
+	/* DECRYPT AND INSTALL */
 	
-	for(int j = 0; j < 16; j++) {
+	// The MAC is checked, so the pages are decrypted straight to the update slot. The
+	// Version Page comes first, and install_page() checks it before anything is written.
+	// Each page is decrypted while the page before it is programmed. The RWW section
+	// cannot be read meanwhile, so the ciphertext is copied to RAM first and decrypted
+	// there, a block at a time between the programming steps.
 	
-		// Read version number from Decrypted Section
-		newVersion = pgm_read_word_far(DECRYPTED_SECTION);
+#ifndef IMAGE_CTR
+	strtFlashCFB(firmwareKey, firmwareIV, &ctx);
+#endif
 	
+	page = next_page(pageMap, 0);
 	
-		// Compare versions
-		if((newVersion != 0) && (newVersion < currentVersion)) {
-		
-			// Firmware Too Old
-			UART1_putchar(NACK);
+#ifdef IMAGE_LZSS
+	strtLZSS(&lzss);
+#endif
+	
+	for(int j = 0; j <= pageCount; j++) {
 		
-			// DEBUG - Version failed
-			UART0_putstring("VN Fail\n");
+		wdt_reset();
 		
-			// Erase Encrypted Section
-			for(int j = 0; j < LOAD_FIRMWARE_PAGE_NUMBER; j++) {
+		// Copy the ciphertext of page j from the Encrypted Section
+		if(j < pageCount) {
+			wait_flash();
 			
-				// Fill page buffer with 0xFF
-				for(int i = 0; i < SPM_PAGESIZE; i++) {
-					pageBuffer[i] = 0xFF;
-				}
-			
-				// Write over Encrypted Section
-				program_flash(ENCRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE, pageBuffer);
+			for(int i = 0; i < SPM_PAGESIZE; i++) {
+				cipher[i] = pgm_read_byte_far(ENCRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE + i);
 			}
+		}
 		
-			wdt_reset();
-		
-			// Erase Decrypted Section
-			for(int j = 0; j < LOAD_FIRMWARE_PAGE_NUMBER; j++) {
-			
-				// Fill page buffer with 0xFF
-				for(int i = 0; i < SPM_PAGESIZE; i++) {
-					pageBuffer[i] = 0xFF;
-				}
+		// Start programming page j - 1
+		if(j > 0) {
+#ifdef IMAGE_LZSS
+			// Installs data, or decompresses it and installs the image pages it completes
+			page = store_page(&lzss, compressed, plain, pageMap, page, pageBuffer, &fill);
+#else
+			install_page(page, plain);
 			
-				// Write over Encrypted Section
-				program_flash(DECRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE, pageBuffer);
-			}
+			page = next_page(pageMap, page + 1);
+#endif
+		}
 		
-			// Reset
-			while(1) {
-				__asm__ __volatile__("");
+		wdt_reset();
+		
+		// Decrypt page j meanwhile
+		if(j < pageCount) {
+			for(int i = 0; i < SPM_PAGESIZE; i += BLOCK_SIZE) {
+#if defined(IMAGE_CTR) && defined(IMAGE_LZSS)
+				cryptCTR(&ctx, compressed ? j : page, i, &cipher[i], BLOCK_SIZE);
+#elif defined(IMAGE_CTR)
+				cryptCTR(&ctx, page, i, &cipher[i], BLOCK_SIZE);
+#else
+				decPageCFB(&ctx, &cipher[i], BLOCK_SIZE);
+#endif
+				
+				poll_flash();
 			}
+			
+			swap   = plain;
+			plain  = cipher;
+			cipher = swap;
 		}
-		else if(newVersion != 0) {
 		
-			// Not DEBUG firmware, update version
-			eeprom_update_word(&fw_version, newVersion);
-		}
+		wdt_reset();
 	}
 	
-	wdt_reset();
+	// The EEPROM is written next
+	wait_flash();
 	
+	wdt_reset();
+#endif /* IMAGE_CCM */
 	
 	
-	/* STORE MESSAGE */
 	
-	for(int j = 1; j < 5; j++) {
-		
-		for(int i = 0; i < SPM_PAGESIZE; i++) {
-			
-			// Read out message
-			pageBuffer[i] = pgm_read_byte_far(DECRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE + i);
-		}
-		
-		// Place in correct location
-		program_flash(MESSAGE_SECTION + (uint32_t)(j - 1) * SPM_PAGESIZE, pageBuffer);
+	// Every image page is installed, and a compressed stream ended with the last one.
+	// The update slot is marked as holding no firmware, so a short image is never booted.
+	if(page != IMAGE_PAGE_NUMBER) {
+		// DEBUG - Tell us the image does not fill its pages
+		refuse_update("Size Fail\n");
 	}
 	
-	wdt_reset();
-	
 	
 	
-	/* STORE PROGRAM */
+	/* ERASE PROGRAM PAGES NOT SENT */
 	
-	for(int j = 5; j < LOAD_FIRMWARE_PAGE_NUMBER - 1; j++) {
+	for(int j = REQUIRED_PAGE_NUMBER; j < IMAGE_PAGE_NUMBER; j++) {
 		switchClock();
 		
-		for(int i = 0; i < SPM_PAGESIZE; i++) {
-			
-			// Read out firmware
-			pageBuffer[i] = pgm_read_byte_far(DECRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE + i);
-		}
-		
 		wdt_reset();
 		
-		// Place in correct location
-		program_flash(APPLICATION_SECTION + (uint32_t)(j - 5) * SPM_PAGESIZE, pageBuffer);
+		// Blank, or unchanged by a delta image
+		if(!baseVersion && !page_sent(pageMap, j)) {
+			erase_flash(slot_address(UPDATE_SLOT, j));
+		}
 	}
 	
+	eeprom_update_word(&fw_installed[UPDATE_SLOT], imageVersion);
+	
 	wdt_reset();
 	
 	//PORTB |= (1<<PINB0);
 	
-	/* ERASE FLASH */
 	
-	for(int j = 0; j < LOAD_FIRMWARE_PAGE_NUMBER * 2; j++) {
-		
-		// Fill page buffer with 0xFF
-		for(int i = 0; i < SPM_PAGESIZE; i++) {
-			pageBuffer[i] = 0xFF;
-		}
-		wdt_reset();
-		// Write over Encrypted Section
-		program_flash(ENCRYPTED_SECTION + (uint32_t)j * SPM_PAGESIZE, pageBuffer);
-	}
+	
+	/* ACTIVATE SLOT */
+	
+	// The update takes effect with this one byte. A reset before it boots the old slot,
+	// and sync_vectors() finishes the job at the next boot if a reset cuts it short.
+	activeSlot = UPDATE_SLOT;
+	
+	eeprom_update_byte(&activeSlotEE, activeSlot);
+	
+	sync_vectors();
 	
 	wdt_reset();
 	
 	// DEBUG - Firmware loaded
 	UART0_putstring("FW Up\n");
+	
+#ifdef BENCHMARK
+	// Flash pages changed, and left as they were
+	reportCycles("Pages written", flashWritten);
+	reportCycles("Pages skipped", flashSkipped);
+#endif
 		
 	
 	// Reset and boot
@@ -948,9 +1260,38 @@ void load_firmware(void) {
 
 
 
+/**
+ * \brief Refuses an update and resets
+ *
+ * Sends a NACK, prints the reason on UART0 (DEBUG) and lets the watchdog reset
+ * the device after 15 ms. Whatever the update wrote stays in flash for the next
+ * one to overwrite: the update slot is not marked installed or active until the
+ * update is complete, so the device keeps booting the firmware it had.
+ *
+ *\param reason Null terminated reason, for the DEBUG output
+ */
+void refuse_update(char* reason)
+{
+	UART1_putchar(NACK);
+	
+	UART0_putstring(reason);
+	
+	wdt_enable(WDTO_15MS);
+	
+	// Reset
+	while(1) {
+		__asm__ __volatile__("");
+	}
+}
+
+
+
 /**
  * \brief Ensures the firmware is loaded correctly and boots it up.
  *
+ * The firmware of the active slot is booted through the vectors in page 0,
+ * which sync_vectors() points at it first.
+ *
  */
 void boot_firmware(void)
 {
@@ -958,19 +1299,30 @@ void boot_firmware(void)
     // Start the Watchdog Timer.
     wdt_enable(WDTO_4S);
 
+	activeSlot = eeprom_read_byte(&activeSlotEE) & 1;
+	
+	
+	
+	/* POINT VECTORS AT ACTIVE SLOT */
+	
+	sync_vectors();
+	
+	wdt_reset();
+	
 	
 
     /* RELEASE MESSAGE */
 	
-    uint8_t cur_byte = pgm_read_byte_far(MESSAGE_SECTION);
+    uint32_t message = SLOT_SECTION(activeSlot) + MESSAGE_SECTION;
+    uint8_t cur_byte = pgm_read_byte_far(message);
 
 	// If there is a release message...
 	if(cur_byte != 0xFF) {
 		
 		// Write out release message to UART0.
-		int addr = MESSAGE_SECTION;
+		uint32_t addr = message;
 	
-		while ((cur_byte != 0x00) && (addr < (MESSAGE_SECTION + 4 * SPM_PAGESIZE))) {
+		while ((cur_byte != 0x00) && (addr < (message + 4 * SPM_PAGESIZE))) {
 			cur_byte = pgm_read_byte_far(addr);
 			UART0_putchar(cur_byte);
 			++addr;
@@ -990,6 +1342,7 @@ void boot_firmware(void)
 
     /* JUMP TO FIRMWARE */
 	
+	// The reset vector of the active slot
     asm ("jmp 0000");
 }
 
@@ -1002,40 +1355,103 @@ void boot_firmware(void)
  * On the atmega1284p, each page is 128 words, or 256 bytes
  *
  * Programing involves four things,
- * 1. Erasing the page
- * 2. Filling a page buffer
+ * 1. Filling a page buffer
+ * 2. Erasing the page
  * 3. Writing a page
  * 4. When you are done programming all of your pages, enable the flash
  *
- * You must fill the buffer one word at a time
+ * Same as write_flash(), waiting until the page is programmed.
  *
  *\param page_address Starting address of page to be programmed
  *\param data 256-byte array of data to be programmed
  */
 void program_flash(uint32_t page_address, unsigned char *data)
+{
+    write_flash(page_address, data);
+
+    wait_flash();
+}
+
+
+
+/**
+ * \brief Starts programming a page of ATMega1284P flash memory
+ *
+ * You must fill the buffer one word at a time. It is filled before the page is
+ * erased, which the ATMega1284P allows, so data can be reused as soon as this
+ * returns. The erase and write steps take about 4.5 ms each and run on their
+ * own: poll_flash() starts the next step once one is done, and wait_flash()
+ * waits for the last one. Until then the RWW section, every page below the
+ * bootloader, cannot be read, and the EEPROM must not be written. The
+ * bootloader runs from the NRWW section, so it can receive or decrypt the next
+ * page meanwhile. A page still being programmed is waited for first.
+ *
+ * The page is compared with data first, as reading it is far quicker than
+ * erasing or writing it. A page that already holds data is left as it is, a
+ * page that is already blank is not erased, and blank data is only erased.
+ * In benchmark builds, flashSkipped and flashWritten count the pages left and
+ * changed.
+ *
+ *\param page_address Starting address of page to be programmed
+ *\param data 256-byte array of data to be programmed
+ */
+void write_flash(uint32_t page_address, unsigned char *data)
 {
     int i = 0;
     uint8_t sreg;
+    uint8_t same  = 1;
+    uint8_t blank = 1;
+    uint8_t empty = 1;
+
+    wait_flash();
+
+    // Compare every byte, the page is needed in full either way
+    for(i = 0; i < SPM_PAGESIZE; i++) {
+        uint8_t current = pgm_read_byte_far(page_address + i);
+
+        same  &= current == data[i];
+        blank &= current == 0xFF;
+        empty &= data[i] == 0xFF;
+    }
+
+    if(same) {
+#ifdef BENCHMARK
+        flashSkipped++;
+#endif
+        return;
+    }
+
+#ifdef BENCHMARK
+    flashWritten++;
+#endif
 
     // Disable interrupts
     sreg = SREG;
     cli();
 
-    boot_page_erase_safe(page_address);
+    if(!empty) {
+        for(i = 0; i < SPM_PAGESIZE; i += 2) {
+            // Make a word out of two bytes
+            uint16_t w = data[i];
+            w += data[i+1] << 8;
 
-    for(i = 0; i < SPM_PAGESIZE; i += 2) {
-		// Make a word out of two bytes
-        uint16_t w = data[i];    
-        w += data[i+1] << 8;
-		
-		// Write to page buffer
-        boot_page_fill_safe(page_address+i, w);
+            // Write to page buffer
+            boot_page_fill_safe(page_address+i, w);
+        }
     }
 
-    boot_page_write_safe(page_address);
-	
-	// We can just enable it after every program too
-    boot_rww_enable_safe(); 
+    flashAddress = page_address;
+
+    if(!blank) {
+        boot_page_erase_safe(page_address);
+
+        flashState = empty ? FLASH_WRITE : FLASH_ERASE;
+    }
+    else {
+        boot_page_write_safe(page_address);
+
+        flashState = FLASH_WRITE;
+    }
 
     //Re-enable interrupts if needed
     SREG = sreg;
@@ -1043,22 +1459,415 @@ void program_flash(uint32_t page_address, unsigned char *data)
 
 
 
+/**
+ * \brief Runs the next step of the page write_flash() started
+ *
+ * Returns at once if the step running is not done, so it can be called often,
+ * e.g. between bytes received or blocks decrypted. Once the page is written,
+ * the RWW section is enabled again.
+ */
+void poll_flash(void)
+{
+    uint8_t sreg;
+
+    if(flashState == FLASH_IDLE || boot_spm_busy()) {
+        return;
+    }
+
+    // Disable interrupts
+    sreg = SREG;
+    cli();
+
+    if(flashState == FLASH_ERASE) {
+        boot_page_write_safe(flashAddress);
+
+        flashState = FLASH_WRITE;
+    }
+    else {
+        // We can just enable it after every program too
+        boot_rww_enable_safe();
+
+        flashState = FLASH_IDLE;
+    }
+
+    //Re-enable interrupts if needed
+    SREG = sreg;
+}
+
+
+
+/**
+ * \brief Waits until the page write_flash() started is programmed
+ *
+ * Afterwards the RWW section can be read and the EEPROM written.
+ */
+void wait_flash(void)
+{
+    while(flashState != FLASH_IDLE) {
+        poll_flash();
+    }
+}
+
+
+
+/**
+ * \brief Erases a page of ATMega1284P flash memory
+ *
+ * Same as program_flash() with a blank page, without filling and writing the
+ * page buffer. An erased page reads as 0xFF, and is left as it is.
+ *
+ *\param page_address Starting address of page to be erased
+ */
+void erase_flash(uint32_t page_address)
+{
+    uint8_t sreg;
+    uint8_t blank = 1;
+
+    wait_flash();
+
+    for(int i = 0; i < SPM_PAGESIZE; i++) {
+        blank &= pgm_read_byte_far(page_address + i) == 0xFF;
+    }
+
+    if(blank) {
+#ifdef BENCHMARK
+        flashSkipped++;
+#endif
+        return;
+    }
+
+#ifdef BENCHMARK
+    flashWritten++;
+#endif
+
+    // Disable interrupts
+    sreg = SREG;
+    cli();
+
+    boot_page_erase_safe(page_address);
+
+    boot_rww_enable_safe();
+
+    //Re-enable interrupts if needed
+    SREG = sreg;
+}
+
+
+
+/**
+ * \brief Checks the Header Page of a firmware update
+ *
+ * The Page Map must only have bits for image pages, the version and message
+ * pages must be sent, and the Page Count must match the Page Map. With
+ * IMAGE_LZSS, the Page Count of a compressed image is that of the compressed
+ * stream, which only has to fit in the ENCRYPTED_SECTION. The header
+ * is not authenticated until the MAC is checked, so this only guards the
+ * flash layout while the pages arrive.
+ *
+ *\param header Header Page, see load_firmware()
+ *\param pageMap HEADER_MAP_SIZE-byte array that will hold the Page Map
+ *\param pageCount Will hold the Page Count
+ *\return 1 if the header is well formed, 0 otherwise
+ */
+uint8_t parse_header(uint8_t* header, uint8_t* pageMap, uint16_t* pageCount)
+{
+    uint16_t sent = 0;
+
+    *pageCount = ((uint16_t)header[HEADER_COUNT] << 8) | header[HEADER_COUNT + 1];
+
+    for(uint8_t i = 0; i < HEADER_MAP_SIZE; i++) {
+        pageMap[i] = header[HEADER_MAP + i];
+    }
+
+    for(uint8_t j = 0; j < HEADER_MAP_SIZE * 8; j++) {
+        if(page_sent(pageMap, j)) {
+            // Only image pages can be sent
+            if(j >= IMAGE_PAGE_NUMBER) {
+                return 0;
+            }
+
+            sent++;
+        }
+        else if(j < REQUIRED_PAGE_NUMBER) {
+            return 0;
+        }
+    }
+
+#ifdef IMAGE_LZSS
+    if(header[HEADER_COUNT] & HEADER_LZSS) {
+        *pageCount &= ~((uint16_t)HEADER_LZSS << 8);
+
+        return *pageCount != 0 && *pageCount <= IMAGE_PAGE_NUMBER;
+    }
+#endif
+
+    return sent == *pageCount;
+}
+
+
+
+/**
+ * \brief Returns non-zero if an image page is sent, according to the Page Map
+ */
+uint8_t page_sent(uint8_t* pageMap, uint8_t page)
+{
+    return pageMap[page >> 3] & (1 << (page & 7));
+}
+
+
+
+/**
+ * \brief Returns the first image page sent from page on, IMAGE_PAGE_NUMBER if none
+ */
+uint8_t next_page(uint8_t* pageMap, uint8_t page)
+{
+    while(page < IMAGE_PAGE_NUMBER && !page_sent(pageMap, page)) {
+        page++;
+    }
+
+    return page;
+}
+
+
+
+/**
+ * \brief Checks the Version Number of a firmware update
+ *
+ * The version must not be older than the one in fw_version, unless it is 0 (DEBUG
+ * firmware). Otherwise the bootloader sends a NACK and the watchdog resets it at
+ * once. A newer version is stored in fw_version. The active slot is never
+ * written. Only the ciphertext has been written, or with IMAGE_CCM the update
+ * slot, which fw_installed marks as holding no firmware (see install_page()).
+ * Either is left for the next update to overwrite, which is quicker than
+ * erasing it here.
+ *
+ *\param versionPage Version Page, decrypted
+ *\return The Version Number
+ */
+uint16_t check_version(uint8_t* versionPage)
+{
+    uint16_t currentVersion = eeprom_read_word(&fw_version);
+    uint16_t newVersion     = 0x0001;
+
+    for(int j = 0; j < 16; j++) {
+
+        // Read version number, again on every pass
+        newVersion = ((volatile uint8_t*)versionPage)[0] | ((uint16_t)((volatile uint8_t*)versionPage)[1] << 8);
+
+        // Compare versions
+        if((newVersion != 0) && (newVersion < currentVersion)) {
+
+            // Firmware Too Old, nothing is erased, see above
+            // DEBUG - Version failed
+            refuse_update("VN Fail\n");
+        }
+        else if(newVersion != 0) {
+
+            // Not DEBUG firmware, update version
+            eeprom_update_word(&fw_version, newVersion);
+        }
+    }
+
+    return newVersion;
+}
+
+
+
+/**
+ * \brief Installs a decrypted image page to the update slot
+ *
+ * The Version Page is only checked, with check_version(), and must come before
+ * the other pages. With IMAGE_CCM it is not authenticated yet, so the Version
+ * Number is kept in stagedVersion instead. The other pages go to their place in
+ * the slot, see slot_address(), and are still being programmed on return (see
+ * write_flash()). fw_installed is cleared for the slot before the first of them
+ * is written, and marks it as holding no firmware until the update is complete:
+ * a refused update leaves its pages in the slot, for the next one to overwrite.
+ *
+ *\param page Image page
+ *\param data Decrypted page
+ */
+void install_page(uint8_t page, uint8_t* data)
+{
+    if(page == 0) {
+        // The EEPROM is not written while a page is programmed
+        wait_flash();
+
+#ifdef IMAGE_CCM
+        stagedVersion[0] = data[0];
+        stagedVersion[1] = data[1];
+#else
+        imageVersion = check_version(data);
+#endif
+
+        // No version is installed in the slot until it is complete
+        eeprom_update_word(&fw_installed[UPDATE_SLOT], 0);
+    }
+    else {
+        write_flash(slot_address(UPDATE_SLOT, page), data);
+    }
+}
+
+
+
+/**
+ * \brief Returns the flash address of an image page in a slot
+ *
+ * The Message Pages are in the MESSAGE_SECTION of the slot and the Firmware
+ * Pages in its APPLICATION_SECTION. Page 0 of flash holds the vectors of the
+ * active slot (see sync_vectors()), so the first Firmware Page of slot 0 is
+ * kept in its VECTOR_HOME page instead.
+ *
+ *\param slot Application slot
+ *\param page Image page, not the Version Page
+ *\return Address of the page
+ */
+uint32_t slot_address(uint8_t slot, uint8_t page)
+{
+    if(page < REQUIRED_PAGE_NUMBER) {
+        return SLOT_SECTION(slot) + MESSAGE_SECTION + (uint32_t)(page - 1) * SPM_PAGESIZE;
+    }
+    else if(slot == 0 && page == REQUIRED_PAGE_NUMBER) {
+        return VECTOR_HOME;
+    }
+    else {
+        return SLOT_SECTION(slot) + APPLICATION_SECTION + (uint32_t)(page - REQUIRED_PAGE_NUMBER) * SPM_PAGESIZE;
+    }
+}
+
+
+
+/**
+ * \brief Points the vectors in page 0 of flash at the active slot
+ *
+ * Reset and every interrupt go through page 0. With slot 0 active, page 0 is
+ * its first Firmware Page, copied from VECTOR_HOME. With slot 1 active, every
+ * vector is a jmp to the same vector of slot 1. Page 0 is only written when it
+ * differs, so this is cheap at every boot and finishes an activation that a
+ * reset cut short. Until an update is installed to slot 0, VECTOR_HOME is blank
+ * and page 0 is left as it is.
+ */
+void sync_vectors(void)
+{
+    uint8_t vectors[SPM_PAGESIZE];
+    uint8_t blank = 1;
+
+    if(activeSlot == 0) {
+        for(int i = 0; i < SPM_PAGESIZE; i++) {
+            vectors[i] = pgm_read_byte_far(VECTOR_HOME + i);
+            blank &= vectors[i] == 0xFF;
+        }
+
+        if(blank) {
+            return;
+        }
+    }
+    else {
+        for(int i = 0; i < SPM_PAGESIZE; i++) {
+            vectors[i] = 0xFF;
+        }
+
+        for(int i = 0; i < _VECTORS_SIZE; i += 4) {
+            // jmp takes a word address, split over both words of the instruction
+            uint32_t target = (SLOT_SECTION(1) + i) >> 1;
+            uint16_t opcode = 0x940C | ((target >> 13) & 0x01F0) | ((target >> 16) & 0x0001);
+
+            vectors[i]     = opcode & 0xFF;
+            vectors[i + 1] = opcode >> 8;
+            vectors[i + 2] = target & 0xFF;
+            vectors[i + 3] = (target >> 8) & 0xFF;
+        }
+    }
+
+    for(int i = 0; i < SPM_PAGESIZE; i++) {
+        if(pgm_read_byte_far(i) != vectors[i]) {
+            program_flash(0, vectors);
+
+            return;
+        }
+    }
+}
+
+
+
+#ifdef IMAGE_LZSS
+/**
+ * \brief Stores one decrypted page of a firmware update
+ *
+ * A page of an uncompressed image is stored as its image page. A page of a
+ * compressed image is fed to the decompressor, and every image page it
+ * completes is stored, in the order of the Page Map, with install_page(). Bytes
+ * of an image page that is not complete yet stay in output, and their number
+ * in fill, for the next call.
+ *
+ *\param ctx Decompressor, started with strtLZSS()
+ *\param compressed Non-zero if the image is compressed, see load_firmware()
+ *\param data Decrypted page
+ *\param pageMap Page Map of the Header Page
+ *\param page Image page being written
+ *\param output Page buffer for the image page being decompressed
+ *\param fill Bytes of output already decompressed
+ *\return The image page stored next, IMAGE_PAGE_NUMBER once all are done, or
+ *        IMAGE_PAGE_NUMBER + 1 if the stream goes on after the last image page
+ */
+uint8_t store_page(lzss_ctx_t* ctx, uint8_t compressed, uint8_t* data, uint8_t* pageMap, uint8_t page, uint8_t* output, uint16_t* fill)
+{
+    if(!compressed) {
+        install_page(page, data);
+
+        return next_page(pageMap, page + 1);
+    }
+
+    // Stream pages after the one that completed the image
+    if(page >= IMAGE_PAGE_NUMBER) {
+        return IMAGE_PAGE_NUMBER + 1;
+    }
+
+    feedLZSS(ctx, data, SPM_PAGESIZE);
+
+    while(page < IMAGE_PAGE_NUMBER) {
+        *fill += readLZSS(ctx, &output[*fill], SPM_PAGESIZE - *fill);
+
+        // Needs the next page of the stream
+        if(*fill < SPM_PAGESIZE) {
+            break;
+        }
+
+        wdt_reset();
+
+        install_page(page, output);
+
+        page = next_page(pageMap, page + 1);
+        *fill = 0;
+    }
+
+    // Only the zero padding of the stream may follow the last image page
+    if(page == IMAGE_PAGE_NUMBER && !endLZSS(ctx)) {
+        return IMAGE_PAGE_NUMBER + 1;
+    }
+
+    return page;
+}
+#endif
+
+
+
 /**
  * \brief Calculates a hash of a memory section
  *
- * This function calculates the CBC-MAC hash of a section in flash. The section is
+ * This function adds a section in flash to a CBC-MAC hash. The section is
  * indexed by pages, where 1 page = 256 bytes.
  *
- * The hash array fed to this function MUST be filled with zeros initially, or the hashing will not
- * work correctly. The startPage parameter refers to the first page to be hashed. The endPage
+ * The hash context fed to this function MUST have been started with strtHashCBC(), and the
+ * result is read out with endHashCBC(). The keyschedule in the context is reused for every
+ * page. The startPage parameter refers to the first page to be hashed. The endPage
  * parameter does not refer to the last page to be hashed, but to the first page to NOT hash.
  *
- * \param key Pointer to 32-byte array containing the AES-256 key.
+ * \param ctx Pointer to a CBC-MAC context started with strtHashCBC().
  * \param startPage Starting 256-byte page of memory to hash (this page WILL be hashed)
  * \param endPage Ending 256-byte page of memory to hash (this page will NOT be hashed)
- * \param hash Pointer to a 16-byte hash array. Must be initialized to all zeros.
  */
-void calcHash(uint8_t* key, uint16_t startPage, uint16_t endPage, uint8_t* hash) {
+void calcHash(hashCBC_ctx_t* ctx, uint16_t startPage, uint16_t endPage) {
 	uint8_t pageBuffer[SPM_PAGESIZE];
 	
 	
@@ -1072,7 +1881,7 @@ void calcHash(uint8_t* key, uint16_t startPage, uint16_t endPage, uint8_t* hash)
 		wdt_reset();
 		
 		// Add to hash
-		hashCBC(key, pageBuffer, hash, SPM_PAGESIZE);
+		contHashCBC(ctx, pageBuffer, SPM_PAGESIZE);
 		
 		switchClock();
 		
@@ -1084,8 +1893,11 @@ void calcHash(uint8_t* key, uint16_t startPage, uint16_t endPage, uint8_t* hash)
 /** 
  * \brief Switches clock based on whether a random number is even or odd
  *
+ * Does nothing unless the SCP profile enables clock switching (SCP=full).
+ *
  */
 void switchClock(void) {
+#if SCP_CLOCK_SWITCH
 	if(quickRand(&randSeed) % 2) {
 		if(fastClock) {
 			setSlowMode();
@@ -1094,6 +1906,7 @@ void switchClock(void) {
 			setFastMode();
 		}
 	}	
+#endif
 }
 
 
@@ -1166,7 +1979,23 @@ uint16_t quickRand(uint16_t* seed) {
 
 void loadSecrets(void) {
 	// Load AES_256 keys
+#ifdef DEVICE_KEYS
+	uint8_t deviceKey[KEY_SIZE] = {0};
+	uint8_t deviceId[KDF_ID_SIZE];
+	
+	// Firmware image keys are derived from the device key and ID
+	safe_eeprom_read_block(deviceKey, deviceKeyEE, 2 * KEY_SIZE);
+	eeprom_read_block(deviceId, deviceIdEE, KDF_ID_SIZE);
+	
+	deriveKey(deviceKey, 'F', deviceId, firmwareKey);
+	deriveKey(deviceKey, 'H', deviceId, imageHashKey);
+	
+	for(uint8_t i = 0; i < KEY_SIZE; i++) {
+		deviceKey[i] = 0;
+	}
+#else
 	safe_eeprom_read_block(firmwareKey, firmwareKeyEE, 2 * KEY_SIZE);
+#endif
 	safe_eeprom_read_block(readbackKey, readbackKeyEE, 2 * KEY_SIZE);
 	safe_eeprom_read_block(hashKey, hashKeyEE, 2 * KEY_SIZE);
 	safe_eeprom_read_block(readbackHashKey, readbackHashKeyEE, 2 * KEY_SIZE);
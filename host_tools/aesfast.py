@@ -0,0 +1,178 @@
+"""AES-256 CFB, CTR, CCM, CBC-MAC and key derivation for the host tools.
+
+Calls the native library in native/ (build it with make -C native), which uses
+AES-NI when the CPU has it. Falls back to PyCrypto when the library has not
+been built, so the tools work either way and give the same output.
+"""
+
+import ctypes
+import os
+import struct
+
+_LIB_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         "native", "libaesfast.so")
+_lib = None
+_loaded = False
+
+
+def _native():
+    """Loads the native library on first use. Returns None if it is missing."""
+    global _lib, _loaded
+    if not _loaded:
+        _loaded = True
+        try:
+            lib = ctypes.CDLL(_LIB_PATH)
+        except OSError:
+            return None
+        for name in ("aesfast_cfb_encrypt", "aesfast_cfb_decrypt"):
+            getattr(lib, name).argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                                           ctypes.c_char_p, ctypes.c_char_p,
+                                           ctypes.c_size_t]
+            getattr(lib, name).restype = None
+        lib.aesfast_cbc_mac.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                                        ctypes.c_size_t, ctypes.c_char_p]
+        lib.aesfast_cbc_mac.restype = None
+        lib.aesfast_ctr_crypt.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                                          ctypes.c_uint32, ctypes.c_char_p,
+                                          ctypes.c_char_p, ctypes.c_size_t]
+        lib.aesfast_ctr_crypt.restype = None
+        lib.aesfast_ccm_encrypt.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                                            ctypes.c_char_p, ctypes.c_size_t,
+                                            ctypes.c_char_p, ctypes.c_char_p,
+                                            ctypes.c_size_t, ctypes.c_char_p]
+        lib.aesfast_ccm_encrypt.restype = None
+        lib.aesfast_aesni.restype = ctypes.c_int
+        _lib = lib
+    return _lib
+
+
+def backend():
+    """Returns which implementation is in use: aes-ni, portable or pycrypto"""
+    lib = _native()
+    if lib is None:
+        return "pycrypto"
+    return "aes-ni" if lib.aesfast_aesni() else "portable"
+
+
+def _pad(inBytes):
+    """Zero pads to a multiple of 16 bytes"""
+    return inBytes + b'\x00'*(-len(inBytes) % 16)
+
+
+def _checkSize(inBytes):
+    if len(inBytes) % 16 != 0:
+        raise ValueError("Input strings must be a multiple of 16 in length")
+
+
+def _xorBytes(a, b):
+    """XORs two byte strings of equal length"""
+    return bytes(bytearray(x ^ y for x, y in zip(bytearray(a), bytearray(b))))
+
+
+def CMACHash(key, inBytes):
+    """ CBC-MAC of inBytes with a zero IV, the last CBC block. Matches hashCBC()
+    in the bootloader"""
+    block = _pad(inBytes)
+    lib = _native()
+    if lib is None:
+        from Crypto.Cipher import AES
+        return AES.new(key, AES.MODE_CBC, b'\x00'*16).encrypt(block)[-16:]
+    mac = ctypes.create_string_buffer(16)
+    lib.aesfast_cbc_mac(key, block, len(block), mac)
+    return mac.raw
+
+
+def encryptAES(key, iv, inBytes):
+    """ Encrypts inBytes, zero padded to 16 bytes, with AES-256 in CFB mode with a
+    16 byte segment. Matches decCFB() in the bootloader"""
+    block = _pad(inBytes)
+    lib = _native()
+    if lib is None:
+        from Crypto.Cipher import AES
+        return AES.new(key, AES.MODE_CFB, iv, segment_size=128).encrypt(block)
+    out = ctypes.create_string_buffer(len(block))
+    lib.aesfast_cfb_encrypt(key, iv, block, out, len(block))
+    return out.raw
+
+
+def decryptAES(key, iv, inBytes):
+    """ Decrypts inBytes, a multiple of 16 bytes, with AES-256 in CFB mode with a
+    16 byte segment. Matches encCFB() in the bootloader"""
+    _checkSize(inBytes)
+    lib = _native()
+    if lib is None:
+        from Crypto.Cipher import AES
+        return AES.new(key, AES.MODE_CFB, iv, segment_size=128).decrypt(inBytes)
+    out = ctypes.create_string_buffer(len(inBytes))
+    lib.aesfast_cfb_decrypt(key, iv, inBytes, out, len(inBytes))
+    return out.raw
+
+
+def encryptCTRPage(key, nonce, page, inBytes):
+    """ Encrypts (or decrypts) one page, a multiple of 16 bytes, with AES-256 in
+    CTR mode. The counter block is the 12 byte nonce and a 4 byte block number,
+    page*16 + block, so pages are independent of each other. Matches cryptCTR()
+    and cryptFlashCTR() in the bootloader"""
+    _checkSize(inBytes)
+    lib = _native()
+    if lib is None:
+        from Crypto.Cipher import AES
+        cipher = AES.new(key, AES.MODE_ECB)
+        return b''.join(_xorBytes(inBytes[i:i+16],
+                                  cipher.encrypt(nonce + struct.pack(">I", page*16 + i//16)))
+                        for i in range(0, len(inBytes), 16))
+    out = ctypes.create_string_buffer(len(inBytes))
+    lib.aesfast_ctr_crypt(key, nonce, page*16, inBytes, out, len(inBytes))
+    return out.raw
+
+
+# CTR is its own inverse
+decryptCTRPage = encryptCTRPage
+
+
+def encryptCCM(key, nonce, inBytes, aad=b''):
+    """ Encrypts and authenticates inBytes, zero padded to 16 bytes, with AES-256
+    in CCM mode, with a 12 byte nonce, 16 byte tag and up to 255 bytes of
+    associated data. Matches strtCCM()/aadCCM()/decCCM()/endCCM() in the
+    bootloader. Returns the ciphertext and the tag"""
+    block = _pad(inBytes)
+    lib = _native()
+    if lib is None:
+        from Crypto.Cipher import AES
+        cipher = AES.new(key, AES.MODE_ECB)
+        # B0 = flags (associated data, 16 byte tag, 3 byte length) | nonce | length
+        flags = b'\x7a' if aad else b'\x3a'
+        mac = cipher.encrypt(flags + nonce + struct.pack(">I", len(block))[1:])
+        # Associated data is its 2 byte length and the data, zero padded
+        if aad:
+            aadBytes = _pad(struct.pack(">H", len(aad)) + aad)
+            for i in range(0, len(aadBytes), 16):
+                mac = cipher.encrypt(_xorBytes(mac, aadBytes[i:i+16]))
+        output = []
+        for i in range(0, len(block), 16):
+            mac = cipher.encrypt(_xorBytes(mac, block[i:i+16]))
+            # Ai = flags (3 byte counter) | nonce | i, starting from A1
+            counter = b'\x02' + nonce + struct.pack(">I", i//16 + 1)[1:]
+            output.append(_xorBytes(block[i:i+16], cipher.encrypt(counter)))
+        tag = _xorBytes(mac, cipher.encrypt(b'\x02' + nonce + b'\x00'*3))
+        return b''.join(output), tag
+    out = ctypes.create_string_buffer(len(block))
+    tag = ctypes.create_string_buffer(16)
+    lib.aesfast_ccm_encrypt(key, nonce, aad, len(aad), block, out, len(block), tag)
+    return out.raw, tag.raw
+
+
+# Size of the identifier a key is derived for. Matches KDF_ID_SIZE in AES_lib.h
+KDF_ID_SIZE = 8
+
+
+def deriveKey(key, label, deviceId):
+    """ Derives a 32 byte key from key, a one character label and a KDF_ID_SIZE
+    byte identifier, with AES-256 as the PRF of an SP 800-108 counter mode KDF.
+    Matches deriveKey() in the bootloader"""
+    if len(deviceId) != KDF_ID_SIZE:
+        raise ValueError("Identifier must be {} bytes".format(KDF_ID_SIZE))
+    blocks = b''.join(chr(i) + label + b'\x00' + deviceId + b'\x01\x00' + b'\x00'*3
+                      for i in (1, 2))
+    # With a zero plaintext, each first CFB block is the encryption of its IV
+    return b''.join(encryptAES(key, blocks[i:i+16], b'\x00'*16) for i in (0, 16))
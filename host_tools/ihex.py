@@ -0,0 +1,100 @@
+"""Streaming Intel HEX parser for the host tools.
+
+Reads a hex file one record at a time and places the data at its address,
+including extended segment (02) and extended linear (04) address records, in a
+sparse map of SPM pages. Flattening the map is linear in the image size, and
+gaps read as erased flash (0xFF) instead of being dropped.
+"""
+
+import binascii
+
+# Flash page size of the ATmega1284P (SPM_PAGESIZE)
+PAGE_SIZE = 256
+
+# Value of erased flash, used for gaps
+ERASED = 0xFF
+
+
+class HexImage(object):
+    """Sparse flash image: page number -> bytearray(PAGE_SIZE). start and end
+    are the lowest address and one past the highest address holding data."""
+
+    def __init__(self):
+        self.pages = {}
+        self.start = None
+        self.end = None
+
+    def put(self, address, data):
+        """Places data at address, across page boundaries as needed."""
+        if not data:
+            return
+        if self.start is None or address < self.start:
+            self.start = address
+        if self.end is None or address + len(data) > self.end:
+            self.end = address + len(data)
+        offset = 0
+        while offset < len(data):
+            page, inPage = divmod(address + offset, PAGE_SIZE)
+            count = min(PAGE_SIZE - inPage, len(data) - offset)
+            if page not in self.pages:
+                self.pages[page] = bytearray([ERASED]) * PAGE_SIZE
+            self.pages[page][inPage:inPage + count] = data[offset:offset + count]
+            offset += count
+
+    def usedPages(self):
+        """Sorted numbers of the pages holding data."""
+        return sorted(self.pages)
+
+    def tobytes(self, start=None, size=None):
+        """Returns size bytes from address start, defaults from self.start to
+        self.end. Addresses without data read as ERASED."""
+        if start is None:
+            start = self.start or 0
+        if size is None:
+            size = max((self.end or 0) - start, 0)
+        if size <= 0:
+            return b''
+        blank = bytes(bytearray([ERASED]) * PAGE_SIZE)
+        firstPage = start // PAGE_SIZE
+        lastPage = (start + size - 1) // PAGE_SIZE
+        out = b''.join(bytes(self.pages[page]) if page in self.pages else blank
+                       for page in range(firstPage, lastPage + 1))
+        skip = start - firstPage * PAGE_SIZE
+        return out[skip:skip + size]
+
+
+def parse(path):
+    """Parses an Intel HEX file into a HexImage. Raises ValueError on a
+    malformed record or a bad checksum."""
+    image = HexImage()
+    base = 0
+    with open(path) as hexFile:
+        for number, line in enumerate(hexFile, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if line[0] != ':':
+                raise ValueError("{}:{}: not a hex record".format(path, number))
+            try:
+                record = bytearray(binascii.unhexlify(line[1:]))
+            except (TypeError, binascii.Error):
+                raise ValueError("{}:{}: bad hex digits".format(path, number))
+            if len(record) < 5 or len(record) != record[0] + 5:
+                raise ValueError("{}:{}: bad record length".format(path, number))
+            if sum(record) & 0xFF:
+                raise ValueError("{}:{}: bad checksum".format(path, number))
+            address = (record[1] << 8) | record[2]
+            recordType = record[3]
+            data = record[4:-1]
+            if recordType == 0x00:
+                image.put(base + address, data)
+            elif recordType == 0x01:
+                break
+            elif recordType in (0x02, 0x04) and len(data) != 2:
+                raise ValueError("{}:{}: bad address record".format(path, number))
+            elif recordType == 0x02:
+                base = ((data[0] << 8) | data[1]) << 4
+            elif recordType == 0x04:
+                base = ((data[0] << 8) | data[1]) << 16
+            # 03 and 05 are start addresses, not data
+    return image
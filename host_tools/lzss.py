@@ -0,0 +1,112 @@
+"""LZSS compressor for firmware images, matching bootloader/lzss.c.
+
+The stream is a flag byte followed by the 8 items it describes, least
+significant bit first. A set bit is a literal byte, a clear bit a 2-byte
+big-endian match: (offset - 1) << LENGTH_BITS | (length - MIN_MATCH). Offsets
+reach back at most WINDOW_SIZE bytes, the RAM window of the bootloader, and the
+window starts out zeroed. There is no end marker.
+"""
+
+# Must match LZSS_WINDOW_BITS and LZSS_MIN_MATCH in bootloader/lzss.h
+WINDOW_BITS = 10
+WINDOW_SIZE = 1 << WINDOW_BITS
+LENGTH_BITS = 16 - WINDOW_BITS
+MIN_MATCH = 3
+MAX_MATCH = MIN_MATCH + (1 << LENGTH_BITS) - 1
+
+# Candidates tried per position, bounds compression time
+MAX_CHAIN = 256
+
+
+def _longestMatch(data, pos, chains):
+    """Returns (length, offset) of the longest match for data[pos:] among the
+    earlier positions with the same 3-byte prefix, (0, 0) if none."""
+    bestLength, bestOffset = 0, 0
+    limit = min(MAX_MATCH, len(data) - pos)
+    if limit < MIN_MATCH:
+        return 0, 0
+    candidates = chains.get(bytes(data[pos:pos + MIN_MATCH]), ())
+    for i in range(len(candidates) - 1, max(len(candidates) - MAX_CHAIN, 0) - 1, -1):
+        start = candidates[i]
+        if pos - start > WINDOW_SIZE:
+            break
+        length = 0
+        while length < limit and data[start + length] == data[pos + length]:
+            length += 1
+        if length > bestLength:
+            bestLength, bestOffset = length, pos - start
+            if length == limit:
+                break
+    return bestLength, bestOffset
+
+
+def compress(data):
+    """Compresses data, greedy with one step of lazy matching. Returns bytes."""
+    data = bytearray(data)
+    out = bytearray()
+    chains = {}
+    items = []
+
+    def insert(pos):
+        if pos + MIN_MATCH <= len(data):
+            chains.setdefault(bytes(data[pos:pos + MIN_MATCH]), []).append(pos)
+
+    pos = 0
+    while pos < len(data):
+        length, offset = _longestMatch(data, pos, chains)
+        if length >= MIN_MATCH:
+            # Take a literal if the match one byte on is longer
+            insert(pos)
+            nextLength, _ = _longestMatch(data, pos + 1, chains)
+            if nextLength > length:
+                items.append(data[pos])
+                pos += 1
+                continue
+            items.append((offset, length))
+            for i in range(pos + 1, pos + length):
+                insert(i)
+            pos += length
+        else:
+            insert(pos)
+            items.append(data[pos])
+            pos += 1
+
+    for i in range(0, len(items), 8):
+        group = items[i:i + 8]
+        flags = 0
+        body = bytearray()
+        for bit, item in enumerate(group):
+            if isinstance(item, tuple):
+                offset, length = item
+                match = ((offset - 1) << LENGTH_BITS) | (length - MIN_MATCH)
+                body += bytearray([match >> 8, match & 0xFF])
+            else:
+                flags |= 1 << bit
+                body.append(item)
+        out.append(flags)
+        out += body
+    return bytes(out)
+
+
+def decompress(data, size):
+    """Decompresses size bytes of data, as the bootloader does. Returns bytes."""
+    data = bytearray(data)
+    out = bytearray()
+    pos = 0
+    while len(out) < size:
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if len(out) >= size:
+                break
+            if flags & (1 << bit):
+                out.append(data[pos])
+                pos += 1
+            else:
+                match = (data[pos] << 8) | data[pos + 1]
+                pos += 2
+                offset = (match >> LENGTH_BITS) + 1
+                for _ in range((match & ((1 << LENGTH_BITS) - 1)) + MIN_MATCH):
+                    # Before the start of the output the window is zeroed
+                    out.append(out[-offset] if offset <= len(out) else 0)
+    return bytes(out[:size])
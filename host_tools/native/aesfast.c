@@ -0,0 +1,595 @@
+/*
+ * AES-256 CFB, CTR, CCM and CBC-MAC for the host tools, loaded by aesfast.py.
+ *
+ * The key schedule is always computed by the portable code. Blocks are
+ * encrypted with AES-NI when __builtin_cpu_supports() reports it, unless
+ * AESFAST_PORTABLE is set in the environment, and with 32-bit T-tables
+ * otherwise. CFB encryption and the CBC-MAC are serial by nature; CFB
+ * decryption and CTR run four independent blocks at a time on AES-NI, and
+ * CCM runs each CBC-MAC block alongside its keystream block.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesfast.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define AESFAST_X86 1
+#endif
+
+#define ROUNDS 14
+
+// CCM flags: B0 with and without associated data, 16 byte tag and 3 byte
+// length, and the counter blocks, 3 byte counter
+#define CCM_B0_AAD   0x7A
+#define CCM_B0       0x3A
+#define CCM_COUNTER  0x02
+
+
+
+/*** TYPES ***/
+
+typedef struct {
+	uint32_t words[4 * (ROUNDS + 1)];   // Big endian round key words
+	uint8_t  bytes[16 * (ROUNDS + 1)];  // Same round keys as bytes, for AES-NI
+} aesfast_ks_t;
+
+
+
+/*** VARIABLES ***/
+
+static uint8_t  sbox[256];
+static uint32_t te[4][256];
+static int      useNI = 0;
+
+
+
+/*** PORTABLE AES ***/
+
+static uint8_t gmul(uint8_t a, uint8_t b) {
+	uint8_t p = 0;
+	
+	while(b) {
+		if(b & 1) {
+			p ^= a;
+		}
+		
+		a = (a << 1) ^ ((a & 0x80) ? 0x1B : 0x00);
+		b >>= 1;
+	}
+	
+	return p;
+}
+
+
+
+static uint32_t ror32(uint32_t x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+
+
+/**
+ * \brief Builds the S-box and T-tables and picks the block function, on load
+ */
+__attribute__((constructor))
+static void aesfast_init(void) {
+	for(int x = 0; x < 256; x++) {
+		uint8_t inv = 0;
+		
+		for(int y = 1; x && y < 256; y++) {
+			if(gmul(x, y) == 1) {
+				inv = y;
+				break;
+			}
+		}
+		
+		uint8_t s = inv;
+		
+		for(int i = 1; i < 5; i++) {
+			s ^= (uint8_t)((inv << i) | (inv >> (8 - i)));
+		}
+		
+		sbox[x] = s ^ 0x63;
+	}
+	
+	for(int x = 0; x < 256; x++) {
+		uint8_t s = sbox[x];
+		
+		te[0][x] = ((uint32_t)gmul(s, 2) << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | gmul(s, 3);
+		te[1][x] = ror32(te[0][x], 8);
+		te[2][x] = ror32(te[0][x], 16);
+		te[3][x] = ror32(te[0][x], 24);
+	}
+	
+#ifdef AESFAST_X86
+	useNI = __builtin_cpu_supports("aes") && !getenv("AESFAST_PORTABLE");
+#endif
+}
+
+
+
+static uint32_t load32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+
+static void store32(uint8_t* p, uint32_t x) {
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+
+
+static uint32_t subWord(uint32_t x) {
+	return ((uint32_t)sbox[x >> 24] << 24) | ((uint32_t)sbox[(x >> 16) & 0xff] << 16) |
+	       ((uint32_t)sbox[(x >> 8) & 0xff] << 8) | sbox[x & 0xff];
+}
+
+
+
+static void expandKey(const uint8_t* key, aesfast_ks_t* ks) {
+	uint32_t rcon = 0x01;
+	
+	for(int i = 0; i < 8; i++) {
+		ks->words[i] = load32(key + 4 * i);
+	}
+	
+	for(int i = 8; i < 4 * (ROUNDS + 1); i++) {
+		uint32_t t = ks->words[i - 1];
+		
+		if(i % 8 == 0) {
+			t = subWord((t << 8) | (t >> 24)) ^ (rcon << 24);
+			rcon = gmul(rcon, 2);
+		}
+		else if(i % 8 == 4) {
+			t = subWord(t);
+		}
+		
+		ks->words[i] = ks->words[i - 8] ^ t;
+	}
+	
+	for(int i = 0; i < 4 * (ROUNDS + 1); i++) {
+		store32(ks->bytes + 4 * i, ks->words[i]);
+	}
+}
+
+
+
+static void encryptPortable(const aesfast_ks_t* ks, const uint8_t* in, uint8_t* out) {
+	const uint32_t* rk = ks->words;
+	uint32_t s0 = load32(in)      ^ rk[0];
+	uint32_t s1 = load32(in + 4)  ^ rk[1];
+	uint32_t s2 = load32(in + 8)  ^ rk[2];
+	uint32_t s3 = load32(in + 12) ^ rk[3];
+	uint32_t t0, t1, t2, t3;
+	
+	for(int r = 1; r < ROUNDS; r++) {
+		rk += 4;
+		t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xff] ^ te[2][(s2 >> 8) & 0xff] ^ te[3][s3 & 0xff] ^ rk[0];
+		t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xff] ^ te[2][(s3 >> 8) & 0xff] ^ te[3][s0 & 0xff] ^ rk[1];
+		t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xff] ^ te[2][(s0 >> 8) & 0xff] ^ te[3][s1 & 0xff] ^ rk[2];
+		t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xff] ^ te[2][(s1 >> 8) & 0xff] ^ te[3][s2 & 0xff] ^ rk[3];
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+	
+	// Last round, no MixColumns
+	rk += 4;
+	store32(out,      (((uint32_t)sbox[s0 >> 24] << 24) | ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) |
+	                   ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) | sbox[s3 & 0xff]) ^ rk[0]);
+	store32(out + 4,  (((uint32_t)sbox[s1 >> 24] << 24) | ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) |
+	                   ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) | sbox[s0 & 0xff]) ^ rk[1]);
+	store32(out + 8,  (((uint32_t)sbox[s2 >> 24] << 24) | ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) |
+	                   ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) | sbox[s1 & 0xff]) ^ rk[2]);
+	store32(out + 12, (((uint32_t)sbox[s3 >> 24] << 24) | ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) |
+	                   ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) | sbox[s2 & 0xff]) ^ rk[3]);
+}
+
+
+
+static void xor16(uint8_t* out, const uint8_t* a, const uint8_t* b) {
+	for(int i = 0; i < 16; i++) {
+		out[i] = a[i] ^ b[i];
+	}
+}
+
+
+
+// Writes counter big endian to the last size bytes of block
+static void setCounter(uint8_t* block, int size, uint32_t counter) {
+	for(int i = 15; i >= 16 - size; i--) {
+		block[i] = counter;
+		counter >>= 8;
+	}
+}
+
+
+
+/*** AES-NI ***/
+
+#ifdef AESFAST_X86
+
+__attribute__((target("aes,sse2")))
+static __m128i encryptNI(const __m128i* rk, __m128i b) {
+	b = _mm_xor_si128(b, rk[0]);
+	
+	for(int r = 1; r < ROUNDS; r++) {
+		b = _mm_aesenc_si128(b, rk[r]);
+	}
+	
+	return _mm_aesenclast_si128(b, rk[ROUNDS]);
+}
+
+
+
+__attribute__((target("aes,sse2")))
+static void loadKeysNI(const aesfast_ks_t* ks, __m128i* rk) {
+	for(int r = 0; r <= ROUNDS; r++) {
+		rk[r] = _mm_loadu_si128((const __m128i*)(ks->bytes + 16 * r));
+	}
+}
+
+
+
+__attribute__((target("aes,sse2")))
+static void cfbEncryptNI(const aesfast_ks_t* ks, const uint8_t* IV, const uint8_t* in, uint8_t* out, size_t size) {
+	__m128i rk[ROUNDS + 1];
+	__m128i chain = _mm_loadu_si128((const __m128i*)IV);
+	
+	loadKeysNI(ks, rk);
+	
+	for(size_t i = 0; i < size; i += 16) {
+		chain = _mm_xor_si128(encryptNI(rk, chain), _mm_loadu_si128((const __m128i*)(in + i)));
+		_mm_storeu_si128((__m128i*)(out + i), chain);
+	}
+}
+
+
+
+__attribute__((target("aes,sse2")))
+static void cfbDecryptNI(const aesfast_ks_t* ks, const uint8_t* IV, const uint8_t* in, uint8_t* out, size_t size) {
+	__m128i rk[ROUNDS + 1];
+	__m128i prev = _mm_loadu_si128((const __m128i*)IV);
+	size_t  i    = 0;
+	
+	loadKeysNI(ks, rk);
+	
+	// Every keystream block depends only on ciphertext, so four run at once
+	for(; i + 64 <= size; i += 64) {
+		__m128i c0 = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i c1 = _mm_loadu_si128((const __m128i*)(in + i + 16));
+		__m128i c2 = _mm_loadu_si128((const __m128i*)(in + i + 32));
+		__m128i c3 = _mm_loadu_si128((const __m128i*)(in + i + 48));
+		__m128i k0 = _mm_xor_si128(prev, rk[0]);
+		__m128i k1 = _mm_xor_si128(c0, rk[0]);
+		__m128i k2 = _mm_xor_si128(c1, rk[0]);
+		__m128i k3 = _mm_xor_si128(c2, rk[0]);
+		
+		for(int r = 1; r < ROUNDS; r++) {
+			k0 = _mm_aesenc_si128(k0, rk[r]);
+			k1 = _mm_aesenc_si128(k1, rk[r]);
+			k2 = _mm_aesenc_si128(k2, rk[r]);
+			k3 = _mm_aesenc_si128(k3, rk[r]);
+		}
+		
+		k0 = _mm_aesenclast_si128(k0, rk[ROUNDS]);
+		k1 = _mm_aesenclast_si128(k1, rk[ROUNDS]);
+		k2 = _mm_aesenclast_si128(k2, rk[ROUNDS]);
+		k3 = _mm_aesenclast_si128(k3, rk[ROUNDS]);
+		
+		_mm_storeu_si128((__m128i*)(out + i),      _mm_xor_si128(k0, c0));
+		_mm_storeu_si128((__m128i*)(out + i + 16), _mm_xor_si128(k1, c1));
+		_mm_storeu_si128((__m128i*)(out + i + 32), _mm_xor_si128(k2, c2));
+		_mm_storeu_si128((__m128i*)(out + i + 48), _mm_xor_si128(k3, c3));
+		prev = c3;
+	}
+	
+	for(; i < size; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i*)(in + i));
+		
+		_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(encryptNI(rk, prev), c));
+		prev = c;
+	}
+}
+
+
+
+__attribute__((target("aes,sse2")))
+static void cbcMacNI(const aesfast_ks_t* ks, const uint8_t* in, size_t size, uint8_t* mac) {
+	__m128i rk[ROUNDS + 1];
+	__m128i m = _mm_setzero_si128();
+	
+	loadKeysNI(ks, rk);
+	
+	for(size_t i = 0; i < size; i += 16) {
+		m = encryptNI(rk, _mm_xor_si128(m, _mm_loadu_si128((const __m128i*)(in + i))));
+	}
+	
+	_mm_storeu_si128((__m128i*)mac, m);
+}
+
+
+
+__attribute__((target("aes,sse2")))
+static void encryptBlockNI(const aesfast_ks_t* ks, const uint8_t* in, uint8_t* out) {
+	__m128i rk[ROUNDS + 1];
+	
+	loadKeysNI(ks, rk);
+	
+	_mm_storeu_si128((__m128i*)out, encryptNI(rk, _mm_loadu_si128((const __m128i*)in)));
+}
+
+
+
+__attribute__((target("aes,sse2")))
+static void ctrNI(const aesfast_ks_t* ks, const uint8_t* nonce, uint32_t counter, const uint8_t* in, uint8_t* out, size_t size) {
+	__m128i rk[ROUNDS + 1];
+	__m128i k[4];
+	uint8_t block[16];
+	size_t  i = 0;
+	
+	loadKeysNI(ks, rk);
+	
+	memcpy(block, nonce, 12);
+	
+	// Counter blocks are known up front, so four run at once
+	for(; i + 64 <= size; i += 64) {
+		for(int j = 0; j < 4; j++) {
+			setCounter(block, 4, counter++);
+			k[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)block), rk[0]);
+		}
+		
+		for(int r = 1; r < ROUNDS; r++) {
+			for(int j = 0; j < 4; j++) {
+				k[j] = _mm_aesenc_si128(k[j], rk[r]);
+			}
+		}
+		
+		for(int j = 0; j < 4; j++) {
+			k[j] = _mm_aesenclast_si128(k[j], rk[ROUNDS]);
+			_mm_storeu_si128((__m128i*)(out + i + 16 * j),
+			                 _mm_xor_si128(k[j], _mm_loadu_si128((const __m128i*)(in + i + 16 * j))));
+		}
+	}
+	
+	for(; i < size; i += 16) {
+		setCounter(block, 4, counter++);
+		k[0] = encryptNI(rk, _mm_loadu_si128((const __m128i*)block));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(k[0], _mm_loadu_si128((const __m128i*)(in + i))));
+	}
+}
+
+
+
+__attribute__((target("aes,sse2")))
+static void ccmEncryptNI(const aesfast_ks_t* ks, uint8_t* counter, const uint8_t* in, uint8_t* out, size_t size, uint8_t* mac) {
+	__m128i rk[ROUNDS + 1];
+	__m128i m = _mm_loadu_si128((const __m128i*)mac);
+	
+	loadKeysNI(ks, rk);
+	
+	// The CBC-MAC and the keystream do not depend on each other, so their
+	// rounds interleave
+	for(size_t i = 0; i < size; i += 16) {
+		__m128i p = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i k;
+		
+		setCounter(counter, 3, i / 16 + 1);
+		k = _mm_xor_si128(_mm_loadu_si128((const __m128i*)counter), rk[0]);
+		m = _mm_xor_si128(_mm_xor_si128(m, p), rk[0]);
+		
+		for(int r = 1; r < ROUNDS; r++) {
+			m = _mm_aesenc_si128(m, rk[r]);
+			k = _mm_aesenc_si128(k, rk[r]);
+		}
+		
+		m = _mm_aesenclast_si128(m, rk[ROUNDS]);
+		k = _mm_aesenclast_si128(k, rk[ROUNDS]);
+		
+		_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(k, p));
+	}
+	
+	_mm_storeu_si128((__m128i*)mac, m);
+}
+
+#endif /* AESFAST_X86 */
+
+
+
+/*** CCM ***/
+
+static void encryptBlock(const aesfast_ks_t* ks, const uint8_t* in, uint8_t* out) {
+#ifdef AESFAST_X86
+	if(useNI) {
+		encryptBlockNI(ks, in, out);
+		return;
+	}
+#endif
+	
+	encryptPortable(ks, in, out);
+}
+
+
+
+/**
+ * \brief Starts the CCM CBC-MAC: B0, then the associated data after its 2 byte
+ * length, zero padded
+ */
+static void ccmStart(const aesfast_ks_t* ks, const uint8_t* nonce, const uint8_t* aad, size_t aadSize, size_t size, uint8_t* mac) {
+	uint8_t block[16] = {0};
+	int     fill      = 2;
+	
+	mac[0] = aadSize ? CCM_B0_AAD : CCM_B0;
+	memcpy(mac + 1, nonce, 12);
+	setCounter(mac, 3, size);
+	encryptBlock(ks, mac, mac);
+	
+	if(!aadSize) {
+		return;
+	}
+	
+	block[0] = aadSize >> 8;
+	block[1] = aadSize;
+	
+	for(size_t i = 0; i < aadSize; i++) {
+		block[fill++] = aad[i];
+		
+		if(fill == 16) {
+			xor16(mac, mac, block);
+			encryptBlock(ks, mac, mac);
+			memset(block, 0, 16);
+			fill = 0;
+		}
+	}
+	
+	if(fill) {
+		xor16(mac, mac, block);
+		encryptBlock(ks, mac, mac);
+	}
+}
+
+
+
+/*** EXPORTED FUNCTIONS ***/
+
+int aesfast_aesni(void) {
+	return useNI;
+}
+
+
+
+void aesfast_cfb_encrypt(const uint8_t* key, const uint8_t* IV, const uint8_t* in, uint8_t* out, size_t size) {
+	aesfast_ks_t ks;
+	uint8_t      chain[16];
+	
+	expandKey(key, &ks);
+	
+#ifdef AESFAST_X86
+	if(useNI) {
+		cfbEncryptNI(&ks, IV, in, out, size);
+		return;
+	}
+#endif
+	
+	memcpy(chain, IV, 16);
+	
+	for(size_t i = 0; i < size; i += 16) {
+		encryptPortable(&ks, chain, chain);
+		xor16(chain, chain, in + i);
+		memcpy(out + i, chain, 16);
+	}
+}
+
+
+
+void aesfast_cfb_decrypt(const uint8_t* key, const uint8_t* IV, const uint8_t* in, uint8_t* out, size_t size) {
+	aesfast_ks_t ks;
+	uint8_t      prev[16], keystream[16];
+	
+	expandKey(key, &ks);
+	
+#ifdef AESFAST_X86
+	if(useNI) {
+		cfbDecryptNI(&ks, IV, in, out, size);
+		return;
+	}
+#endif
+	
+	memcpy(prev, IV, 16);
+	
+	for(size_t i = 0; i < size; i += 16) {
+		encryptPortable(&ks, prev, keystream);
+		memcpy(prev, in + i, 16);
+		xor16(out + i, keystream, prev);
+	}
+}
+
+
+
+void aesfast_cbc_mac(const uint8_t* key, const uint8_t* in, size_t size, uint8_t* mac) {
+	aesfast_ks_t ks;
+	uint8_t      m[16] = {0};
+	
+	expandKey(key, &ks);
+	
+#ifdef AESFAST_X86
+	if(useNI) {
+		cbcMacNI(&ks, in, size, mac);
+		return;
+	}
+#endif
+	
+	for(size_t i = 0; i < size; i += 16) {
+		xor16(m, m, in + i);
+		encryptPortable(&ks, m, m);
+	}
+	
+	memcpy(mac, m, 16);
+}
+
+
+
+void aesfast_ctr_crypt(const uint8_t* key, const uint8_t* nonce, uint32_t counter, const uint8_t* in, uint8_t* out, size_t size) {
+	aesfast_ks_t ks;
+	uint8_t      block[16], keystream[16];
+	
+	expandKey(key, &ks);
+	
+#ifdef AESFAST_X86
+	if(useNI) {
+		ctrNI(&ks, nonce, counter, in, out, size);
+		return;
+	}
+#endif
+	
+	memcpy(block, nonce, 12);
+	
+	for(size_t i = 0; i < size; i += 16) {
+		setCounter(block, 4, counter++);
+		encryptPortable(&ks, block, keystream);
+		xor16(out + i, in + i, keystream);
+	}
+}
+
+
+
+void aesfast_ccm_encrypt(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, size_t aadSize,
+                         const uint8_t* in, uint8_t* out, size_t size, uint8_t* tag) {
+	aesfast_ks_t ks;
+	uint8_t      mac[16], counter[16], keystream[16];
+	
+	expandKey(key, &ks);
+	
+	ccmStart(&ks, nonce, aad, aadSize, size, mac);
+	
+	counter[0] = CCM_COUNTER;
+	memcpy(counter + 1, nonce, 12);
+	
+#ifdef AESFAST_X86
+	if(useNI) {
+		ccmEncryptNI(&ks, counter, in, out, size, mac);
+	}
+	else
+#endif
+	{
+		for(size_t i = 0; i < size; i += 16) {
+			xor16(mac, mac, in + i);
+			encryptPortable(&ks, mac, mac);
+			
+			setCounter(counter, 3, i / 16 + 1);
+			encryptPortable(&ks, counter, keystream);
+			xor16(out + i, in + i, keystream);
+		}
+	}
+	
+	// Tag is the CBC-MAC encrypted with counter block 0
+	setCounter(counter, 3, 0);
+	encryptBlock(&ks, counter, keystream);
+	xor16(tag, mac, keystream);
+}
@@ -0,0 +1,28 @@
+/*
+ * AES-256 CFB, CTR, CCM and CBC-MAC for the host tools, loaded by aesfast.py.
+ *
+ * Uses AES-NI when the CPU has it and a portable table-based AES otherwise.
+ * All sizes are in bytes and must be multiples of 16, except the associated
+ * data of CCM. CFB uses a 16-byte segment, and the CBC-MAC a zero IV, as the
+ * bootloader does. CTR counter blocks are the 12-byte nonce and a big endian
+ * 32-bit block counter, starting from counter. CCM uses a 12-byte nonce and a
+ * 16-byte tag, as in the bootloader's strtCCM().
+ */
+
+#ifndef AESFAST_H_
+#define AESFAST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 1 when AES-NI is in use, 0 for the portable code
+int aesfast_aesni(void);
+
+void aesfast_cfb_encrypt(const uint8_t* key, const uint8_t* IV, const uint8_t* in, uint8_t* out, size_t size);
+void aesfast_cfb_decrypt(const uint8_t* key, const uint8_t* IV, const uint8_t* in, uint8_t* out, size_t size);
+void aesfast_cbc_mac(const uint8_t* key, const uint8_t* in, size_t size, uint8_t* mac);
+void aesfast_ctr_crypt(const uint8_t* key, const uint8_t* nonce, uint32_t counter, const uint8_t* in, uint8_t* out, size_t size);
+void aesfast_ccm_encrypt(const uint8_t* key, const uint8_t* nonce, const uint8_t* aad, size_t aadSize,
+                         const uint8_t* in, uint8_t* out, size_t size, uint8_t* tag);
+
+#endif /* AESFAST_H_ */